@@ -0,0 +1,171 @@
+#include "blend.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIX2D_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIX2D_SSE2
+#endif
+
+namespace pix2d {
+
+    static inline uint32_t pack(Pixel p) {
+        uint32_t v;
+        memcpy(&v, &p, sizeof(v));
+        return v;
+    }
+
+#ifdef PIX2D_SSE2
+    // over operator for 4 pixels whose destination alpha is 255
+    // channels are widened to 16 bits, so s * sa + d * (255 - sa) <= 65025 never overflows
+    static inline __m128i over_opaque_sse2(__m128i d, __m128i s) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i c255 = _mm_set1_epi16(255);
+        const __m128i amask = _mm_set1_epi32((int) 0xFF000000);
+
+        __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+        __m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+
+        // broadcast the source alpha to every channel of its pixel
+        __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+        __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(slo, alo), _mm_mullo_epi16(dlo, _mm_sub_epi16(c255, alo)));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(shi, ahi), _mm_mullo_epi16(dhi, _mm_sub_epi16(c255, ahi)));
+
+        // div255
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+
+        return _mm_or_si128(_mm_packus_epi16(lo, hi), amask);
+    }
+
+    // true if all 4 pixels have alpha 255
+    static inline bool opaque_sse2(__m128i d) {
+        const __m128i amask = _mm_set1_epi32((int) 0xFF000000);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(d, amask), amask)) == 0xFFFF;
+    }
+#endif
+
+#ifdef PIX2D_AVX2
+    // same as over_opaque_sse2, 8 pixels at a time (unpack and pack both work per 128-bit lane)
+    static inline __m256i over_opaque_avx2(__m256i d, __m256i s) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi16(1);
+        const __m256i c255 = _mm256_set1_epi16(255);
+        const __m256i amask = _mm256_set1_epi32((int) 0xFF000000);
+
+        __m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+        __m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+
+        __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+        __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(slo, alo), _mm256_mullo_epi16(dlo, _mm256_sub_epi16(c255, alo)));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(shi, ahi), _mm256_mullo_epi16(dhi, _mm256_sub_epi16(c255, ahi)));
+
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one), _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one), _mm256_srli_epi16(hi, 8)), 8);
+
+        return _mm256_or_si256(_mm256_packus_epi16(lo, hi), amask);
+    }
+
+    static inline bool opaque_avx2(__m256i d) {
+        const __m256i amask = _mm256_set1_epi32((int) 0xFF000000);
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(d, amask), amask)) == -1;
+    }
+#endif
+
+    // REPLACE is a plain store
+    template <>
+    void blend_fill<BlendMode::REPLACE>(Pixel* dst, Pixel s, int n) {
+        int i = 0;
+
+#ifdef PIX2D_AVX2
+        const __m256i s8 = _mm256_set1_epi32((int) pack(s));
+        for (; i + 8 <= n; i += 8) _mm256_storeu_si256((__m256i*) (dst + i), s8);
+#endif
+
+#ifdef PIX2D_SSE2
+        const __m128i s4 = _mm_set1_epi32((int) pack(s));
+        for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*) (dst + i), s4);
+#endif
+
+        for (; i < n; i++) dst[i] = s;
+    }
+
+    template <>
+    void blend_span<BlendMode::REPLACE>(Pixel* dst, const Pixel* src, int n) {
+        if (n > 0) memcpy(dst, src, n * sizeof(Pixel));
+    }
+
+    // ALPHA, vectorised where the destination is opaque
+    template <>
+    void blend_fill<BlendMode::ALPHA>(Pixel* dst, Pixel s, int n) {
+        int i = 0;
+
+#ifdef PIX2D_AVX2
+        const __m256i s8 = _mm256_set1_epi32((int) pack(s));
+        for (; i + 8 <= n; i += 8) {
+            __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+            if (opaque_avx2(d)) {
+                _mm256_storeu_si256((__m256i*) (dst + i), over_opaque_avx2(d, s8));
+            } else {
+                for (int k = i; k < i + 8; k++) dst[k] = blend_over(dst[k], s);
+            }
+        }
+#endif
+
+#ifdef PIX2D_SSE2
+        const __m128i s4 = _mm_set1_epi32((int) pack(s));
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+            if (opaque_sse2(d)) {
+                _mm_storeu_si128((__m128i*) (dst + i), over_opaque_sse2(d, s4));
+            } else {
+                for (int k = i; k < i + 4; k++) dst[k] = blend_over(dst[k], s);
+            }
+        }
+#endif
+
+        for (; i < n; i++) dst[i] = blend_over(dst[i], s);
+    }
+
+    template <>
+    void blend_span<BlendMode::ALPHA>(Pixel* dst, const Pixel* src, int n) {
+        int i = 0;
+
+#ifdef PIX2D_AVX2
+        for (; i + 8 <= n; i += 8) {
+            __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+            if (opaque_avx2(d)) {
+                __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+                _mm256_storeu_si256((__m256i*) (dst + i), over_opaque_avx2(d, s));
+            } else {
+                for (int k = i; k < i + 8; k++) dst[k] = blend_over(dst[k], src[k]);
+            }
+        }
+#endif
+
+#ifdef PIX2D_SSE2
+        for (; i + 4 <= n; i += 4) {
+            __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+            if (opaque_sse2(d)) {
+                __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+                _mm_storeu_si128((__m128i*) (dst + i), over_opaque_sse2(d, s));
+            } else {
+                for (int k = i; k < i + 4; k++) dst[k] = blend_over(dst[k], src[k]);
+            }
+        }
+#endif
+
+        for (; i < n; i++) dst[i] = blend_over(dst[i], src[i]);
+    }
+
+}
@@ -0,0 +1,167 @@
+#include "command.h"
+
+#include <cstring>
+
+namespace pix2d {
+    // RECORDING
+    // appends every command in other
+    void CommandBuffer::append(const CommandBuffer& other) {
+        for (auto& cmd : other) {
+            if (cmd.op == DrawOp::CLEAR) clear();
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(&cmd);
+            data.insert(data.end(), p, p + cmd.size);
+            count++;
+        }
+    }
+
+    // empties the buffer, keeping its memory
+    void CommandBuffer::clear() {
+        data.clear();
+        count = 0;
+    }
+
+    void CommandBuffer::swap(CommandBuffer& other) {
+        data.swap(other.data);
+        std::swap(count, other.count);
+    }
+
+
+    // QUERIES
+    bool CommandBuffer::empty() const {
+        return count == 0;
+    }
+
+    // number of commands
+    size_t CommandBuffer::size() const {
+        return count;
+    }
+
+    // size of the stream in bytes
+    size_t CommandBuffer::bytes() const {
+        return data.size();
+    }
+
+    // FNV-1a hash of the stream
+    uint64_t CommandBuffer::hash() const {
+        uint64_t h = 14695981039346656037ull;
+        for (uint8_t b : data) {
+            h ^= b;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    // true if both streams are byte for byte the same
+    bool CommandBuffer::operator==(const CommandBuffer& other) const {
+        return data.size() == other.data.size() && (data.empty() || memcmp(data.data(), other.data.data(), data.size()) == 0);
+    }
+
+    bool CommandBuffer::operator!=(const CommandBuffer& other) const {
+        return !(*this == other);
+    }
+
+    // the command starting at byte offset
+    const CommandHeader* CommandBuffer::at(uint32_t offset) const {
+        return reinterpret_cast<const CommandHeader*>(data.data() + offset);
+    }
+
+    uint32_t CommandBuffer::offset_of(const CommandHeader& cmd) const {
+        return (uint32_t) (reinterpret_cast<const uint8_t*>(&cmd) - data.data());
+    }
+
+
+    // OPTIMISATION PASSES
+    // drops commands that cannot touch area
+    void CommandBuffer::cull(const Rect& area) {
+        size_t read = 0, write = 0;
+        while (read < data.size()) {
+            CommandHeader* cmd = reinterpret_cast<CommandHeader*>(&data[read]);
+            uint32_t size = cmd->size;
+            if (!cmd->bounds.intersect(area).empty()) {
+                if (write != read) memmove(&data[write], &data[read], size);
+                write += size;
+            } else {
+                count--;
+            }
+            read += size;
+        }
+        data.resize(write);
+    }
+
+    // joins consecutive FILL commands with the same colour and mode whose union is a rect
+    void CommandBuffer::merge() {
+        size_t read = 0, write = 0;
+        CommandHeader* last = nullptr;
+        while (read < data.size()) {
+            CommandHeader* cmd = reinterpret_cast<CommandHeader*>(&data[read]);
+            uint32_t size = cmd->size;
+
+            if (last && last->op == DrawOp::FILL && cmd->op == DrawOp::FILL && last->mode == cmd->mode) {
+                RectCommand* a = last->payload<RectCommand>();
+                const RectCommand* b = cmd->payload<RectCommand>();
+                bool same_colour = memcmp(&a->f, &b->f, sizeof(Pixel)) == 0;
+
+                // b directly below a, same columns
+                bool stacked = a->x == b->x && a->w == b->w && a->y + a->h == b->y;
+                // b directly right of a, same rows
+                bool beside = a->y == b->y && a->h == b->h && a->x + a->w == b->x;
+
+                if (same_colour && (stacked || beside)) {
+                    if (stacked) a->h += b->h;
+                    else a->w += b->w;
+                    last->bounds = Rect(a->x, a->y, a->x + a->w, a->y + a->h);
+                    count--;
+                    read += size;
+                    continue;
+                }
+            }
+
+            if (write != read) memmove(&data[write], &data[read], size);
+            last = reinterpret_cast<CommandHeader*>(&data[write]);
+            write += size;
+            read += size;
+        }
+        data.resize(write);
+    }
+
+    // stable sort by op, mode and sprite so similar commands run together
+    // a command only moves past commands it does not overlap
+    void CommandBuffer::sort() {
+        if (count < 2) return;
+
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        for (auto& cmd : *this) order.push_back(offset_of(cmd));
+
+        auto key_less = [this](uint32_t a, uint32_t b) {
+            const CommandHeader* ca = at(a);
+            const CommandHeader* cb = at(b);
+            if (ca->op != cb->op) return ca->op < cb->op;
+            if (ca->mode != cb->mode) return ca->mode < cb->mode;
+            if (ca->op == DrawOp::SPRITE) return ca->payload<SpriteCommand>()->sprite < cb->payload<SpriteCommand>()->sprite;
+            if (ca->op == DrawOp::SPRITE_TRANSFORMED) return ca->payload<TransformedSpriteCommand>()->sprite < cb->payload<TransformedSpriteCommand>()->sprite;
+            if (ca->op == DrawOp::SPRITE_RLE) return ca->payload<RleSpriteCommand>()->sprite < cb->payload<RleSpriteCommand>()->sprite;
+            if (ca->op == DrawOp::FONT_TEXT) return ca->payload<FontTextCommand>()->font < cb->payload<FontTextCommand>()->font;
+            return false;
+        };
+
+        // insertion sort, stopping at the first command that overlaps (their order matters)
+        for (size_t i = 1; i < order.size(); i++) {
+            uint32_t cur = order[i];
+            size_t j = i;
+            while (j > 0 && key_less(cur, order[j - 1]) && at(cur)->bounds.intersect(at(order[j - 1])->bounds).empty()) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = cur;
+        }
+
+        std::vector<uint8_t> sorted;
+        sorted.reserve(data.size());
+        for (uint32_t offset : order) {
+            const uint8_t* p = data.data() + offset;
+            sorted.insert(sorted.end(), p, p + at(offset)->size);
+        }
+        data.swap(sorted);
+    }
+}
@@ -1,5 +1,12 @@
 #include "engine.h"
 
+#include <imgui.h>
+#include <imgui_impl_opengl3.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace pix2d {
     Engine::Engine() {
         
@@ -8,10 +15,11 @@ namespace pix2d {
     Engine::~Engine() {
         if (canvas_sprite) delete canvas_sprite;
         if (font_sprite) delete font_sprite;
+        if (raster_pool) delete raster_pool;
     }
 
     // USER ENGINE FUNCTIONS
-    bool Engine::initialise(int canvas_width, int canvas_height, int screen_width, int screen_height, const std::string& eng_name) {
+    bool Engine::initialise(int canvas_width, int canvas_height, int screen_width, int screen_height, const std::string& eng_name, Backend backend) {
         if (canvas_width < 0 || canvas_height < 0) return false;
         if (screen_width < 0 || screen_height < 0) return false;
         if (is_running) return false;
@@ -21,6 +29,7 @@ namespace pix2d {
         this->screen_width = screen_width;
         this->screen_height = screen_height;
         if (!eng_name.empty()) engine_name = eng_name;
+        this->backend = backend;
 
         Engine::engine_instance = this;
 
@@ -32,8 +41,12 @@ namespace pix2d {
         if (!prepare()) return false;
 
         is_running = true;
+        engine_finished = false;
         std::thread t = std::thread(&Engine::engine_thread, this);
 
+        // the main thread owns the window and pumps its events into the input ring until the engine stops
+        if (window) pump_events();
+
         t.join();
 
         if (!clean_up()) return false;
@@ -43,6 +56,7 @@ namespace pix2d {
 
     bool Engine::close() {
         if (is_running) is_running = false;
+        wake();
         return is_running;
     }
 
@@ -58,6 +72,11 @@ namespace pix2d {
         return false;
     }
 
+    // called step_ms apart in simulated time in fixed step mode
+    bool Engine::fixed_update(double step_ms) {
+        return true;
+    }
+
     // called when engine stops
     bool Engine::destroy() {
         return true;
@@ -71,14 +90,15 @@ namespace pix2d {
         return screen_height;
     }
 
+    // window changes are applied by the main thread
     void Engine::set_screen_width(int width) {
         screen_width = width;
-        glfwSetWindowSize(window, screen_width, screen_height);
+        request_window_size(screen_width, screen_height);
     }
 
     void Engine::set_screen_height(int height) {
         screen_height = height;
-        glfwSetWindowSize(window, screen_width, screen_height);
+        request_window_size(screen_width, screen_height);
     }
 
     int Engine::get_canvas_width() {
@@ -90,11 +110,191 @@ namespace pix2d {
     }
 
     void Engine::set_title(const std::string& title) {
-        glfwSetWindowTitle(window, title.c_str());
+        if (!window) return;
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            pending_title = title;
+            title_changed = true;
+        }
+        glfwPostEmptyEvent();
     }
 
+    // seconds since the engine started, simulated time when using a fixed delta time
     double Engine::get_time() {
-        return glfwGetTime();
+        if (fixed_delta_time > 0.0) return sim_time / 1000.0;
+        return clock_ms() / 1000.0;
+    }
+
+    bool Engine::is_headless() {
+        return backend == Backend::HEADLESS;
+    }
+
+    // number of frames run so far
+    long long Engine::get_frame_count() {
+        return frame_count;
+    }
+
+    // stop the engine after this many frames, 0 runs until update() returns false
+    void Engine::set_frame_limit(int frames) {
+        frame_limit = frames;
+    }
+
+    // pass delta_time ms to update() every frame instead of the measured time, <= 0 goes back to measuring
+    void Engine::set_fixed_delta_time(double delta_time) {
+        fixed_delta_time = delta_time;
+    }
+
+    // opt-in: record the draw calls made in update() and rasterise them after it returns
+    void Engine::set_deferred(bool enabled) {
+        deferred = enabled;
+    }
+
+    // in deferred mode, skip rasterising a frame whose commands are identical to the previous frame's
+    void Engine::set_skip_identical_frames(bool enabled) {
+        skip_identical_frames = enabled;
+    }
+
+    // opt-in: record the draw calls made in update() and rasterise them in screen tiles on a pool of threads
+    void Engine::set_threaded_raster(bool enabled, int threads) {
+        threaded_raster = enabled;
+        if (threads != raster_threads && raster_pool) {
+            delete raster_pool;
+            raster_pool = nullptr;
+        }
+        raster_threads = threads;
+    }
+
+    // opt-in: time each phase of every frame
+    void Engine::set_profiling(bool enabled) {
+        profiling = enabled;
+    }
+
+    // shows or hides the profiler overlay (turns profiling on), does nothing in headless mode
+    void Engine::set_profiler_overlay(bool visible) {
+        profiler_overlay = visible && backend == Backend::WINDOW;
+        if (profiler_overlay) profiling = true;
+    }
+
+    bool Engine::get_profiler_overlay() {
+        return profiler_overlay;
+    }
+
+    const Profiler& Engine::get_profiler() {
+        return profiler;
+    }
+
+    // opt-in: update and rasterise on the engine thread while a render thread uploads and presents the previous frame
+    // buffers 3: the engine thread never waits, the render thread always presents the newest frame (frames can be dropped)
+    // buffers 2: the engine thread waits for the render thread to take each frame, so none are dropped
+    // call before start, ignored in headless mode, low latency mode has no effect while pipelined
+    void Engine::set_pipelined(bool enabled, int buffers) {
+        pipelined = enabled;
+        pipeline_depth = buffers <= 2 ? 2 : 3;
+    }
+
+    // opt-in: only run a frame when input arrives, a timer fires or invalidate() is called
+    // timeout_ms > 0 also runs a frame when nothing happened for that long
+    void Engine::set_idle_mode(bool enabled, double timeout_ms) {
+        idle_timeout = std::max(0.0, timeout_ms);
+        idle_mode = enabled;
+        invalidate();
+    }
+
+    // asks for a new frame in idle mode, safe from any thread
+    void Engine::invalidate() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            invalidated = true;
+        }
+        idle_cv.notify_one();
+    }
+
+    // asks for a new frame in ms (for animations in idle mode), an earlier request wins
+    void Engine::invalidate_in(double ms) {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            double t = clock_ms() + std::max(0.0, ms);
+            if (invalidate_time <= 0.0 || t < invalidate_time) invalidate_time = t;
+        }
+        idle_cv.notify_one();
+    }
+
+    // frame limiter target, 0 doesn't limit (the default)
+    void Engine::set_target_fps(double fps) {
+        target_fps = std::max(0.0, fps);
+    }
+
+    // frame rates used instead of the target while the window is unfocused or iconified, 0 keeps the target
+    void Engine::set_background_fps(double unfocused, double iconified) {
+        unfocused_fps = std::max(0.0, unfocused);
+        iconified_fps = std::max(0.0, iconified);
+    }
+
+    // vsync mode, applied at the start of the next frame
+    void Engine::set_vsync(VSync mode) {
+        vsync_mode = mode;
+    }
+
+    VSync Engine::get_vsync() {
+        if (vsync_mode == VSync::ADAPTIVE && adaptive_unsupported) return VSync::ON;
+        return vsync_mode;
+    }
+
+    // achieved frame intervals over the last PACING_FRAMES frames
+    PacingStats Engine::get_pacing_stats() {
+        PacingStats stats;
+        stats.target_ms = pacing_target_ms;
+
+        int n = (int) std::min<long long>(interval_index, PACING_FRAMES);
+        if (n == 0) return stats;
+
+        double total = 0.0;
+        for (int i = 0; i < n; i++) total += frame_intervals[i];
+        stats.mean_ms = total / n;
+
+        // jitter is the standard deviation of the intervals
+        double variance = 0.0;
+        for (int i = 0; i < n; i++) {
+            double d = frame_intervals[i] - stats.mean_ms;
+            variance += d * d;
+            stats.max_ms = std::max(stats.max_ms, frame_intervals[i]);
+        }
+        stats.jitter_ms = std::sqrt(variance / n);
+        stats.frames = n;
+        return stats;
+    }
+
+    // opt-in: call fixed_update every step_ms of elapsed time, update then gets the interpolation factor instead of delta time
+    // at most max_steps steps run per frame, the rest are skipped so a slow frame can't snowball
+    void Engine::set_fixed_timestep(bool enabled, double step_ms, int max_steps) {
+        fixed_step = enabled && step_ms > 0.0;
+        fixed_step_ms = step_ms;
+        max_fixed_steps = std::max(1, max_steps);
+        step_accumulator = 0.0;
+    }
+
+    // steps skipped because a frame ran past max_steps, since the engine started
+    long long Engine::get_skipped_steps() {
+        return skipped_steps;
+    }
+
+    // opt-in: sleep until just before the next vblank, then sample input, update and present
+    // margin_ms is the extra room left for a frame that takes longer than usual
+    void Engine::set_low_latency(bool enabled, double margin_ms) {
+        low_latency = enabled;
+        latency_margin = margin_ms;
+        last_present = 0.0;
+        frame_work_ms = 0.0;
+    }
+
+    // input to present latency of the last frame, only measured in low latency mode
+    LatencyStats Engine::get_latency_stats() {
+        return latency_stats;
+    }
+
+    // canvas texture upload timings for the last frame
+    UploadStats Engine::get_upload_stats() {
+        return presented_upload_stats;
     }
 
 
@@ -102,11 +302,15 @@ namespace pix2d {
     // ENGINE WORKINGS
     // setup opengl contexts
     bool Engine::prepare() {
-        // opengl setup
-        if (!glfwInit()) return false;
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        clock_origin = std::chrono::steady_clock::now();
+
+        // opengl setup (headless runs without glfw entirely)
+        if (backend == Backend::WINDOW) {
+            if (!glfwInit()) return false;
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        }
 
         // map glfw input to the engine's representation
         map_kb[GLFW_KEY_UNKNOWN] = Key::UNKNOWN;
@@ -140,47 +344,174 @@ namespace pix2d {
 
         map_kb[GLFW_KEY_LEFT_SHIFT] = Key::L_SHIFT; map_kb[GLFW_KEY_LEFT_CONTROL] = Key::L_CTRL; map_kb[GLFW_KEY_LEFT_ALT] = Key::L_ALT;
         map_kb[GLFW_KEY_RIGHT_SHIFT] = Key::R_SHIFT; map_kb[GLFW_KEY_RIGHT_CONTROL] = Key::R_CTRL; map_kb[GLFW_KEY_RIGHT_ALT] = Key::R_ALT;
-                        
+
+        // glfw windows have to be created (and their events pumped) on the main thread
+        if (backend == Backend::WINDOW) return create_window();
         return true;
     }
 
-    // threaded function, first calls create, then continuously updates engine, then calls destroy
-    void Engine::engine_thread() {
-        // set up window, as well as load glad
-        if (!thread_prepare()) {
-            is_running = false;
-            return;
+    // creates the window, on the main thread as glfw requires
+    bool Engine::create_window() {
+        window = glfwCreateWindow(screen_width, screen_height, engine_name.c_str(), NULL, NULL);
+        if (window == NULL) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
         }
 
-        // run user create function
-        if (!create()) {
-            is_running = false;
-            return;
+        // the low latency loop plans its frames around the monitor's refresh rate
+        const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        if (mode && mode->refreshRate > 0) refresh_rate = mode->refreshRate;
+
+        // set some callbacks, they run on the main thread and only push into the input ring
+        glfwSetFramebufferSizeCallback(window, window_resize_callback); // resizing the window
+        glfwSetKeyCallback(window, keyboard_callback); // keyboard input
+        glfwSetMouseButtonCallback(window, mouse_button_callback); // mouse button input
+        glfwSetCursorPosCallback(window, mouse_pos_callback); // mouse position
+        glfwSetWindowFocusCallback(window, window_focus_callback); // frame limiter throttling
+        glfwSetWindowIconifyCallback(window, window_iconify_callback);
+        return true;
+    }
+
+    // main thread loop: waits for window events (callbacks fill the input ring) and applies window changes
+    void Engine::pump_events() {
+        while (!engine_finished) {
+            // wakes up for input, for glfwPostEmptyEvent from the engine thread, and every 100ms regardless
+            glfwWaitEventsTimeout(0.1);
+            // the mouse moves of this batch of events went in as one
+            if (input_ring.flush()) wake();
+            if (glfwWindowShouldClose(window)) {
+                // one request per close, so the close button still works if destroy() keeps the engine running
+                glfwSetWindowShouldClose(window, GLFW_FALSE);
+                is_running = false;
+                wake();
+            }
+
+            std::string title;
+            bool set_title = false, set_size = false;
+            int w = 0, h = 0;
+            {
+                std::lock_guard<std::mutex> lock(window_mutex);
+                if (title_changed) title.swap(pending_title);
+                set_title = title_changed;
+                set_size = size_changed;
+                w = pending_width; h = pending_height;
+                title_changed = size_changed = false;
+            }
+            if (set_title) glfwSetWindowTitle(window, title.c_str());
+            if (set_size) glfwSetWindowSize(window, w, h);
+            if (profiler_overlay) poll_overlay_input();
+        }
+    }
+
+    // reads the window and mouse state the overlay needs into overlay_input
+    // imgui's glfw backend would poll glfw from the thread drawing the overlay, which glfw doesn't allow
+    void Engine::poll_overlay_input() {
+        OverlayInput in;
+        glfwGetWindowSize(window, &in.window_width, &in.window_height);
+        glfwGetFramebufferSize(window, &in.framebuffer_width, &in.framebuffer_height);
+        glfwGetCursorPos(window, &in.mouse_x, &in.mouse_y);
+        for (int i = 0; i < 3; i++) in.mouse_down[i] = glfwGetMouseButton(window, i) == GLFW_PRESS;
+        in.focused = glfwGetWindowAttrib(window, GLFW_FOCUSED) != 0;
+
+        std::lock_guard<std::mutex> lock(window_mutex);
+        overlay_input = in;
+    }
+
+    // asks the main thread to resize the window
+    void Engine::request_window_size(int width, int height) {
+        if (!window) return;
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            pending_width = width;
+            pending_height = height;
+            size_changed = true;
+        }
+        glfwPostEmptyEvent();
+    }
+
+    // applies the input events received since the last frame to the input state
+    // stops early at an event that would undo a change made this frame (a press and release
+    // within one frame), so every press is seen for at least one frame
+    void Engine::drain_input() {
+        frame_events.clear();
+
+        bool key_changed[NUM_KEYS] = { 0 };
+        bool mbtn_changed[NUM_MOUSE] = { 0 };
+
+        while (const InputEvent* e = input_ring.front()) {
+            if (e->type == InputType::KEY) {
+                if (key_changed[e->code]) break;
+                key_changed[e->code] = keyboard_new[e->code] != e->down;
+                keyboard_new[e->code] = e->down;
+            } else if (e->type == InputType::MOUSE_BUTTON) {
+                if (mbtn_changed[e->code]) break;
+                mbtn_changed[e->code] = mbtn_new[e->code] != e->down;
+                mbtn_new[e->code] = e->down;
+            } else if (e->type == InputType::MOUSE_MOVE) {
+                mouseX = e->x;
+                mouseY = e->y;
+            } else if (e->type == InputType::RESIZE) {
+                screen_width = (int) e->x;
+                screen_height = (int) e->y;
+                // applied by whichever thread presents
+                viewport_width = screen_width;
+                viewport_height = screen_height;
+                viewport_changed = true;
+            }
+            frame_events.push_back(*e);
+            input_ring.pop();
         }
+    }
+
+    // threaded function, first calls create, then continuously updates engine, then calls destroy
+    void Engine::engine_thread() {
+        // set up the gl context, as well as load glad, then run user create function
+        if (thread_prepare() && create()) {
+            // pipelined: the render thread takes over the gl context
+            if (pipelined && window) start_render_thread();
+
+            // update loop
+            while (is_running) {
+                while (is_running) engine_update();
 
-        // update loop
-        while (is_running) {
-            while (is_running) engine_update();
+                if (!destroy()) is_running = true;
+            }
 
-            if (!destroy()) is_running = true;
+            stop_render_thread();
+            destroy_overlay();
+        } else {
+            is_running = false;
         }
+
+        // let the main thread's event loop see that the engine stopped
+        engine_finished = true;
+        if (window) glfwPostEmptyEvent();
     }
 
     // clean up
     bool Engine::clean_up() {
-        glfwTerminate();
+        if (backend == Backend::WINDOW) glfwTerminate();
         return true;
     }
 
+    // milliseconds since prepare(), usable without glfw
+    double Engine::clock_ms() {
+        if (backend == Backend::WINDOW) return glfwGetTime() * 1000.0;
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - clock_origin).count();
+    }
+
     // thread-specific preparation
     bool Engine::thread_prepare() {
-        // create window
-        window = glfwCreateWindow(screen_width, screen_height, engine_name.c_str(), NULL, NULL);
-        if (window == NULL) {
-            std::cout << "Failed to create GLFW window" << std::endl;
-            glfwTerminate();
-            return false;
+        // headless: only the cpu canvas, no window or gl context
+        if (backend == Backend::HEADLESS) {
+            if (!construct_canvas() || !construct_font()) is_running = false;
+            time_1 = clock_ms();
+            time_2 = clock_ms();
+            return is_running;
         }
+
+        // the window is created by the main thread, its context is used only here
         glfwMakeContextCurrent(window);
         if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
             std::cout << "Failed to initialise GLAD" << std::endl;
@@ -192,34 +523,46 @@ namespace pix2d {
         // create canvas and font sprites
         if (!construct_canvas() || !construct_font()) is_running = false;
 
-        // set some callbacks
-        glfwSetFramebufferSizeCallback(window, window_resize_callback); // resizing the window
-        glfwSetKeyCallback(window, keyboard_callback); // keyboard input
-        glfwSetMouseButtonCallback(window, mouse_button_callback); // mouse button input
-        glfwSetCursorPosCallback(window, mouse_pos_callback); // mouse position
-
         // enable alpha blending
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         // reset the times
-        time_1 = glfwGetTime() * 1000.0;
-        time_2 = glfwGetTime() * 1000.0;
+        time_1 = clock_ms();
+        time_2 = clock_ms();
         return is_running;
     }
 
     // thread calls this, checks for input, user update, draw graphics
     void Engine::engine_update() {
-        // check if user tries to close window
-        if (glfwWindowShouldClose(window)) {
-            is_running = false;
-            return;
+        // idle mode: sleep until input arrives, a timer fires or invalidate() is called
+        if (idle_mode) {
+            wait_for_work();
+            if (!is_running) return;
         }
-        
+
+        PIX2D_TRACE_ZONE("frame");
+        profile_begin_frame();
+
+        // low latency: sleep first, so input is sampled as close to the next present as possible
+        if (low_latency && window) {
+            PIX2D_TRACE_ZONE("wait");
+            wait_for_deadline();
+        }
+        profile_phase(Phase::WAIT);
+
         // calculate delta_time
-        time_2 = glfwGetTime() * 1000.0;
-        double delta_time = time_2 - time_1;
+        time_2 = clock_ms();
+        double delta_time = fixed_delta_time > 0.0 ? fixed_delta_time : time_2 - time_1;
         time_1 = time_2;
+        sim_time += delta_time;
+
+        // take the input events the main thread received since the last frame
+        {
+            PIX2D_TRACE_ZONE("poll");
+            drain_input();
+        }
+        profile_phase(Phase::POLL);
 
         // check input events
         // we are now comparing the new state with the old state
@@ -266,33 +609,461 @@ namespace pix2d {
             // the new state is now the old state
             mbtn_old[i] = mbtn_new[i];
         }
+        profile_phase(Phase::INPUT);
+
+
+        // do user update, recording the draw calls in deferred mode
+        recording_frame = deferred || threaded_raster;
+        bool updated = true;
+        if (fixed_step) {
+            PIX2D_TRACE_ZONE("fixed_update");
+            updated = run_fixed_steps(delta_time);
+        }
+        profile_phase(Phase::FIXED);
+        if (updated) {
+            PIX2D_TRACE_ZONE("update");
+            // in fixed step mode update gets how far the frame is between the last step and the next, for interpolating
+            updated = update(fixed_step ? step_accumulator / fixed_step_ms : delta_time);
+        }
+        recording_frame = false;
+        profile_phase(Phase::UPDATE);
 
+        // rasterise whatever was recorded
+        flush_commands();
+        profile_phase(Phase::RASTER);
 
-        // do user update
-        if (!update(delta_time)) {
+        if (!updated) {
             is_running = false;
             return;
         }
 
+        // stop after a fixed number of frames (the last one is still presented)
+        frame_count++;
+        if (frame_limit > 0 && frame_count >= frame_limit) is_running = false;
+
+        if (pipelined && window) {
+            // pipelined: hand the frame to the render thread and start on the next one
+            publish_frame();
+            // the copy for the render thread counts as the upload
+            profile_phase(Phase::UPLOAD);
+        } else if (backend == Backend::WINDOW) {
+            if (!present(nullptr, true)) {
+                is_running = false;
+                return;
+            }
+            if (low_latency) measure_latency(time_2);
+        }
+        // headless frames end here too, the result is in canvas_sprite
+
+        pace_frame();
+        profile_phase(Phase::WAIT);
+        profile_end_frame();
+    }
+
+    // draws frame (the canvas if nullptr) and the overlay to the screen and swaps
+    // profile times the phases, only for the engine thread
+    bool Engine::present(PipelineFrame* frame, bool profile) {
+        if (viewport_changed.exchange(false)) glViewport(0, 0, viewport_width, viewport_height);
+        // the render thread takes the mode from the frame, vsync_mode belongs to the engine thread
+        VSync vsync = frame ? frame->vsync : vsync_mode;
+        if (vsync != applied_vsync) {
+            apply_vsync(vsync);
+            applied_vsync = vsync;
+        }
+
         // background fill
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // draw canvas to screen
-        if (!draw_canvas()) {
-            is_running = false;
-            return;
-        }
+        if (!draw_canvas(frame)) return false;
+        if (frame) frame->upload_stats = upload_stats;
+        else presented_upload_stats = upload_stats;
+        if (profile) profile_phase(Phase::UPLOAD);
+
+        if (profiler_overlay) draw_overlay(frame);
+        if (profile) profile_phase(Phase::OVERLAY);
 
         // swap buffers and display
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            PIX2D_TRACE_ZONE("swap");
+            glfwSwapBuffers(window);
+            // low latency: don't let the driver queue frames ahead, the swap is done when this returns
+            // (not while pipelined, where low latency mode has no effect)
+            if (!frame && low_latency) glFinish();
+        }
+        if (profile) profile_phase(Phase::SWAP);
+        return true;
+    }
+
+    // PIPELINED RENDERING
+    // the engine thread draws into canvas_sprite as usual, then copies each finished frame into one of
+    // PIPELINE_FRAMES frame buffers and swaps its index into pipeline_ready. the render thread swaps
+    // its own buffer's index back out and presents it. each thread only ever touches the buffer it
+    // holds, the handoff is a single atomic exchange and no frame data is shared
+    // a frame carries the rects to upload, a copy of the profiler's frames and the vsync mode, and brings its
+    // upload stats back, so apart from the atomics the render thread doesn't touch engine thread state.
+    // only the tiles that changed are copied and uploaded, static frames cost neither
+
+    // gives the gl context to a new render thread
+    void Engine::start_render_thread() {
+        size_t tiles = dirty_tiles.size();
+        for (int i = 0; i < PIPELINE_FRAMES; i++) {
+            pipeline_frames[i].sprite = new Sprite(canvas_width, canvas_height);
+            pipeline_stale[i].assign(tiles, 0);
+        }
+        pipeline_pending.assign(tiles, 0);
+        // the first frame fills every buffer and the whole texture
+        std::fill(dirty_tiles.begin(), dirty_tiles.end(), 1);
+        dirty_count = (int) tiles;
+        pipeline_ready = 0;
+        pipeline_write = 1;
+        pipeline_read = 2;
+
+        glfwMakeContextCurrent(NULL);
+        render_running = true;
+        render_thread = std::thread(&Engine::render_loop, this);
+    }
+
+    // stops the render thread and takes the gl context back
+    void Engine::stop_render_thread() {
+        if (!render_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(pipeline_mutex);
+            render_running = false;
+        }
+        pipeline_cv.notify_all();
+        render_thread.join();
+        glfwMakeContextCurrent(window);
+
+        for (int i = 0; i < PIPELINE_FRAMES; i++) {
+            delete pipeline_frames[i].sprite;
+            pipeline_frames[i] = PipelineFrame();
+        }
+    }
+
+    // copies rects of src to dst, both canvas-sized images with bottom-up rows
+    static void copy_rects(uint8_t* dst, const uint8_t* src, int w, int h, const std::vector<Rect>& rects) {
+        for (const Rect& r : rects) {
+            size_t row_bytes = (size_t) (r.x1 - r.x0) * sizeof(Pixel);
+            for (int row = h - r.y1; row < h - r.y0; row++) {
+                size_t offset = ((size_t) row * w + r.x0) * sizeof(Pixel);
+                memcpy(dst + offset, src + offset, row_bytes);
+            }
+        }
+    }
+
+    // engine thread: brings the buffer it holds up to date with the canvas and swaps it for the next free one
+    void Engine::publish_frame() {
+        PIX2D_TRACE_ZONE("publish");
+        if (!render_running) return;
+
+        // two buffers: wait until the render thread took the last frame, so no frame is dropped
+        if (pipeline_depth == 2) {
+            std::unique_lock<std::mutex> lock(pipeline_mutex);
+            pipeline_cv.wait(lock, [this] { return !(pipeline_ready.load(std::memory_order_acquire) & PIPELINE_FRESH) || !render_running; });
+        }
+
+        // the previous frame was taken already (always, with two buffers), the texture will have its tiles
+        if (!(pipeline_ready.load(std::memory_order_acquire) & PIPELINE_FRESH)) std::fill(pipeline_pending.begin(), pipeline_pending.end(), 0);
+
+        // tiles drawn this frame are missing from every buffer, copy the ones this buffer is missing
+        PipelineFrame& frame = pipeline_frames[pipeline_write];
+        std::vector<uint8_t>& stale = pipeline_stale[pipeline_write];
+        for (size_t t = 0; t < dirty_tiles.size(); t++) {
+            if (!dirty_tiles[t]) continue;
+            for (auto& s : pipeline_stale) s[t] = 1;
+            pipeline_pending[t] = 1;
+        }
+        tile_rects(stale, pipeline_copy);
+        copy_rects((uint8_t*) frame.sprite->get_data(), (const uint8_t*) canvas_sprite->get_data(), canvas_width, canvas_height, pipeline_copy);
+        std::fill(stale.begin(), stale.end(), 0);
+
+        // the texture holds the last frame the render thread took, so this one uploads everything since then
+        tile_rects(pipeline_pending, frame.rects);
+
+        frame.vsync = vsync_mode;
+        // the render thread draws the overlay from this copy instead of the profiler, which this thread keeps writing
+        frame.profile.clear();
+        if (profiler_overlay) {
+            frame.profile.resize(PROFILER_FRAMES);
+            frame.profile.resize(profiler.get_frames(frame.profile.data(), PROFILER_FRAMES));
+        }
+
+        int old = pipeline_ready.exchange(pipeline_write | PIPELINE_FRESH, std::memory_order_acq_rel);
+        pipeline_write = old & PIPELINE_INDEX;
+
+        // the previous frame was taken and is drawn before this one, so only this frame's tiles stay pending
+        // (if it was dropped instead, its tiles stay pending too)
+        if (!(old & PIPELINE_FRESH)) {
+            pipeline_pending = dirty_tiles;
+            // and the buffer handed back has been presented
+            presented_upload_stats = pipeline_frames[pipeline_write].upload_stats;
+        }
+        std::fill(dirty_tiles.begin(), dirty_tiles.end(), 0);
+        dirty_count = 0;
+
+        { std::lock_guard<std::mutex> lock(pipeline_mutex); }
+        pipeline_cv.notify_all();
+    }
+
+    // render thread: presents the newest published frame, sleeping while there is none
+    void Engine::render_loop() {
+        glfwMakeContextCurrent(window);
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(pipeline_mutex);
+                pipeline_cv.wait(lock, [this] { return (pipeline_ready.load(std::memory_order_acquire) & PIPELINE_FRESH) || !render_running; });
+            }
+            if (!render_running) break;
+
+            int old = pipeline_ready.exchange(pipeline_read, std::memory_order_acq_rel);
+            pipeline_read = old & PIPELINE_INDEX;
+
+            // a two buffer engine thread may be waiting for this frame to be taken
+            { std::lock_guard<std::mutex> lock(pipeline_mutex); }
+            pipeline_cv.notify_all();
+
+            PIX2D_TRACE_ZONE("render");
+            if (!present(&pipeline_frames[pipeline_read], false)) {
+                is_running = false;
+                std::lock_guard<std::mutex> lock(pipeline_mutex);
+                render_running = false;
+                break;
+            }
+        }
+        pipeline_cv.notify_all();
+
+        destroy_overlay();
+        glfwMakeContextCurrent(NULL);
+    }
+
+    // idle mode: blocks until there is a reason to draw a frame
+    void Engine::wait_for_work() {
+        PIX2D_TRACE_ZONE("idle");
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        auto ready = [this] { return invalidated || !is_running || input_ring.front() != nullptr; };
+
+        while (!ready()) {
+            // wake for the nearest of the idle timeout and the invalidate_in timer
+            double deadline = invalidate_time;
+            if (idle_timeout > 0.0) {
+                double timeout = last_frame_end + idle_timeout;
+                if (deadline <= 0.0 || timeout < deadline) deadline = timeout;
+            }
+            if (deadline <= 0.0) {
+                idle_cv.wait(lock);
+                continue;
+            }
+
+            double remaining = deadline - clock_ms();
+            if (remaining <= 0.0) break;
+            idle_cv.wait_for(lock, std::chrono::microseconds((long long) (remaining * 1000.0)));
+        }
+
+        invalidated = false;
+        // waking for input or invalidate() keeps a pending invalidate_in timer for a later frame
+        if (invalidate_time > 0.0 && clock_ms() >= invalidate_time) invalidate_time = 0.0;
+    }
+
+    // wakes the engine thread if it is idle, safe from any thread
+    void Engine::wake() {
+        if (!idle_mode) return;
+        // taking the lock means the engine thread is either waiting (and gets the notify) or hasn't checked yet
+        { std::lock_guard<std::mutex> lock(idle_mutex); }
+        idle_cv.notify_one();
+    }
+
+    // frame limiter: waits until the next frame is due at the target rate, then records the frame interval
+    // unfocused and iconified windows use their own (usually lower) rates to save power
+    void Engine::pace_frame() {
+        double fps = target_fps;
+        if (window_iconified) fps = iconified_fps > 0.0 ? iconified_fps : target_fps;
+        else if (!window_focused) fps = unfocused_fps > 0.0 ? unfocused_fps : target_fps;
+
+        double now = clock_ms();
+        if (fps > 0.0) {
+            PIX2D_TRACE_ZONE("limit");
+            double period = 1000.0 / fps;
+            next_frame_time += period;
+            // too far behind (or just started): restart the schedule instead of rushing to catch up
+            if (next_frame_time < now - period || next_frame_time > now + period) next_frame_time = now + period;
+            wait_until(next_frame_time);
+            now = clock_ms();
+        } else {
+            next_frame_time = now;
+        }
+
+        // interval between the ends of the last two frames
+        if (last_frame_end > 0.0) {
+            frame_intervals[interval_index % PACING_FRAMES] = now - last_frame_end;
+            interval_index++;
+        }
+        last_frame_end = now;
+        pacing_target_ms = fps > 0.0 ? 1000.0 / fps : 0.0;
+    }
+
+    // sets the swap interval for the vsync mode, falls back to ON if adaptive vsync isn't supported
+    void Engine::apply_vsync(VSync mode) {
+        // the driver's setting can't be read back, so it stays whatever was last applied
+        if (mode == VSync::DRIVER) return;
+        if (mode == VSync::ADAPTIVE) {
+            if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+                glfwSwapInterval(-1);
+                return;
+            }
+            adaptive_unsupported = true;
+            mode = VSync::ON;
+        }
+        glfwSwapInterval(mode == VSync::ON ? 1 : 0);
+    }
+
+    // sleeps until clock_ms() reaches t, spinning for the last ms so it doesn't oversleep
+    void Engine::wait_until(double t) {
+        double remaining = t - clock_ms();
+        if (remaining > 1.5) std::this_thread::sleep_for(std::chrono::microseconds((long long) ((remaining - 1.0) * 1000.0)));
+        while (clock_ms() < t) std::this_thread::yield();
+    }
+
+    // low latency: sleeps until the expected next vblank minus the expected frame time and the margin
+    void Engine::wait_for_deadline() {
+        latency_stats.wait_ms = 0.0;
+        if (last_present <= 0.0) return;
+
+        double period = 1000.0 / refresh_rate;
+        double wake = last_present + period - frame_work_ms - latency_margin;
+        double now = clock_ms();
+        if (wake <= now) return;
+
+        wait_until(wake);
+        latency_stats.wait_ms = clock_ms() - now;
+    }
+
+    // low latency: records the time from input to present for the frame that just finished
+    void Engine::measure_latency(double sample_time) {
+        double present = clock_ms();
+        double work = present - sample_time;
+
+        // keep an average of the frame time so the next wait leaves enough room
+        frame_work_ms = frame_work_ms <= 0.0 ? work : frame_work_ms * 0.9 + work * 0.1;
+        last_present = present;
+
+        latency_stats.work_ms = work;
+        latency_stats.events = (int) frame_events.size();
+        // from the oldest input event used this frame
+        latency_stats.input_to_present_ms = 0.0;
+        if (!frame_events.empty()) latency_stats.input_to_present_ms = present - frame_events.front().time * 1000.0;
+    }
+
+    // fixed step mode: calls fixed_update once per whole step of elapsed time, at most max_fixed_steps times
+    // time past that budget is dropped (and counted as skipped steps) instead of being caught up later
+    bool Engine::run_fixed_steps(double delta_time) {
+        step_accumulator += delta_time;
+
+        int steps = 0;
+        while (step_accumulator >= fixed_step_ms && steps < max_fixed_steps) {
+            if (!fixed_update(fixed_step_ms)) return false;
+            step_accumulator -= fixed_step_ms;
+            steps++;
+        }
+
+        int skipped = 0;
+        if (step_accumulator >= fixed_step_ms) {
+            skipped = (int) (step_accumulator / fixed_step_ms);
+            step_accumulator -= skipped * fixed_step_ms;
+            skipped_steps += skipped;
+        }
+
+        frame_times.fixed_steps = steps;
+        frame_times.skipped_steps = skipped;
+        return true;
+    }
+
+    // starts timing a frame
+    void Engine::profile_begin_frame() {
+        if (!profiling) return;
+        frame_times = FrameTimes();
+        frame_start = phase_start = clock_ms();
+    }
+
+    // ends the current phase of the frame and starts the next (a phase can be timed more than once per frame)
+    void Engine::profile_phase(Phase phase) {
+        if (!profiling) return;
+        double now = clock_ms();
+        frame_times.ms[(int) phase] += now - phase_start;
+        phase_start = now;
+    }
+
+    // stores the frame in the profiler
+    void Engine::profile_end_frame() {
+        if (!profiling) return;
+        frame_times.ms[(int) Phase::FRAME] = clock_ms() - frame_start;
+        profiler.push(frame_times);
+    }
+
+    // draws the profiler overlay with imgui, creating the imgui context the first time
+    // pipelined frames bring their own copy of the profiler's frames, the render thread can't read the profiler
+    void Engine::draw_overlay(const PipelineFrame* frame) {
+        if (!imgui_ready) {
+            ImGui::CreateContext();
+            // no glfw backend, this may not be the main thread, the main thread feeds imgui through overlay_input
+            ImGui_ImplOpenGL3_Init("#version 330");
+            overlay_time = clock_ms();
+            imgui_ready = true;
+        }
+
+        OverlayInput in;
+        bool clicks[3];
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            in = overlay_input;
+            for (int i = 0; i < 3; i++) {
+                clicks[i] = overlay_clicks[i];
+                overlay_clicks[i] = false;
+            }
+        }
+
+        ImGuiIO& io = ImGui::GetIO();
+        io.DisplaySize = ImVec2((float) in.window_width, (float) in.window_height);
+        if (in.window_width > 0 && in.window_height > 0) {
+            io.DisplayFramebufferScale = ImVec2((float) in.framebuffer_width / in.window_width, (float) in.framebuffer_height / in.window_height);
+        }
+        double now = clock_ms();
+        io.DeltaTime = (float) std::max((now - overlay_time) / 1000.0, 1e-4);
+        overlay_time = now;
+        io.MousePos = in.focused ? ImVec2((float) in.mouse_x, (float) in.mouse_y) : ImVec2(-FLT_MAX, -FLT_MAX);
+        for (int i = 0; i < 3; i++) io.MouseDown[i] = in.mouse_down[i] || clicks[i];
+
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui::NewFrame();
+        if (frame) Profiler::draw_overlay(frame->profile.data(), (int) frame->profile.size());
+        else profiler.draw_overlay();
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+
+    // releases the imgui context, needs the gl context to still be current
+    void Engine::destroy_overlay() {
+        if (!imgui_ready) return;
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui::DestroyContext();
+        imgui_ready = false;
     }
 
     // initialises canvas sprite
     bool Engine::construct_canvas() {
         canvas_sprite = new Sprite(canvas_width, canvas_height);
 
+        // everything needs uploading the first time
+        dirty_tiles_x = (canvas_width + TILE_SIZE - 1) / TILE_SIZE;
+        dirty_tiles_y = (canvas_height + TILE_SIZE - 1) / TILE_SIZE;
+        dirty_tiles.assign(dirty_tiles_x * dirty_tiles_y, 1);
+        dirty_count = (int) dirty_tiles.size();
+
+        // headless has nothing to upload to
+        if (backend == Backend::HEADLESS) return true;
+
         // define the canvas quad and indices
         float canvas_quad[] = {
             -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
@@ -314,6 +1085,12 @@ namespace pix2d {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+        // allocate the texture storage once, draw_canvas only updates the parts that changed
+        // immutable storage where available, so the driver never has to check for a reallocation
+        if (GLAD_GL_ARB_texture_storage) glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, canvas_width, canvas_height);
+        else glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, canvas_width, canvas_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        construct_pbos();
+
         // generate the buffer objects
         glGenVertexArrays(1, &canvas_vao);
         glGenBuffers(1, &canvas_vbo);
@@ -335,6 +1112,7 @@ namespace pix2d {
         // build the shaders
         // shaders are stored in res/defaults/canvas.[frag|vert]
         canvas_shader = Shader("res/defaults/canvas.vert", "res/defaults/canvas.frag");
+        canvas_tex_uniform = canvas_shader.uniform<int>("cTex");
 
         return true;
     }
@@ -344,24 +1122,51 @@ namespace pix2d {
         // default font is the atari character set limited to the printable ascii characters
         // font data (sprite data) is stored in res/defaults/default_font.png 
         font_sprite = new Sprite("res/defaults/font.png");
-        if (font_sprite) return true;
-        else return false;
+        if (!font_sprite) return false;
+
+        // decode each 8x8 glyph into a bitmask once, text never reads font_sprite
+        if (font_sprite->get_data() && font_sprite->get_width() >= NUM_CHARS_X * CHAR_SIZE && font_sprite->get_height() >= NUM_CHARS_Y * CHAR_SIZE) {
+            for (int index = 0; index < NUM_CHARS_X * NUM_CHARS_Y; index++) {
+                int sx = (index % NUM_CHARS_X) * CHAR_SIZE;
+                int sy = (index / NUM_CHARS_X) * CHAR_SIZE;
+
+                uint64_t mask = 0;
+                for (int j = 0; j < CHAR_SIZE; j++) {
+                    Pixel* row = font_sprite->get_row(sy + j) + sx;
+                    for (int i = 0; i < CHAR_SIZE; i++) {
+                        if (row[i].a > 0) mask |= (uint64_t) 1 << (CHAR_SIZE * j + i);
+                    }
+                }
+                glyph_masks[index] = mask;
+            }
+        }
+        return true;
     }
 
     // draw canvas to screen
-    bool Engine::draw_canvas() {
+    // frame is a whole frame from the render pipeline, nullptr draws canvas_sprite
+    bool Engine::draw_canvas(const PipelineFrame* frame) {
+        PIX2D_TRACE_ZONE("draw_canvas");
         if (!canvas_sprite) return false;
 
         if (canvas_sprite->get_data()) {
             // bind texture buffer (glBindTexture)
             glActiveTexture(GL_TEXTURE0); // optional, but set it just in case
             glBindTexture(GL_TEXTURE_2D, canvas_texture);
-            // update texture buffer (glTexImage2D)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, canvas_sprite->get_width(), canvas_sprite->get_height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, (uint8_t*) canvas_sprite->get_data());
+            upload_stats = UploadStats();
+            upload_stats.persistent = pbo_persistent;
+            if (frame) {
+                // pipelined frames carry what changed since the last frame this thread drew (nothing on static frames)
+                upload_rects = frame->rects;
+                if (!upload_rects.empty()) upload((const uint8_t*) frame->sprite->get_data());
+            } else if (dirty_count > 0) {
+                // upload the parts of the canvas that changed (nothing on static frames)
+                upload_dirty();
+            }
             // create and draw quad to screen (bind vertex buffer, buffer vertex info, glDrawArrays)
             glBindVertexArray(canvas_vao);
             canvas_shader.use();
-            canvas_shader.set_int("cTex", 0); // optional, but set it just in case
+            canvas_tex_uniform.set(0); // optional, but set it just in case
             glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
             glBindVertexArray(0);
         } else return false;
@@ -370,136 +1175,1222 @@ namespace pix2d {
     }   
 
 
-    // DRAWING FUNCTIONS
-    // draws a point at (x, y)
-    void Engine::point(int x, int y, Pixel p) {
-        if (!canvas_sprite) return;
+    // creates the ring of pixel buffers the canvas is streamed through
+    // persistently mapped when the driver has ARB_buffer_storage, mapped every frame otherwise
+    void Engine::construct_pbos() {
+        GLsizeiptr size = (GLsizeiptr) canvas_width * canvas_height * sizeof(Pixel);
+        pbo_persistent = GLAD_GL_ARB_buffer_storage != 0;
+
+        glGenBuffers(PBO_COUNT, canvas_pbo);
+        for (int i = 0; i < PBO_COUNT; i++) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, canvas_pbo[i]);
+            if (pbo_persistent) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+                canvas_pbo_ptr[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+            } else {
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            }
+            canvas_pbo_fence[i] = 0;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
 
-        // get original pixel colour
-        Pixel op = canvas_sprite->get_pixel(x, y);
+    // binds the next pixel buffer in the ring and returns where to write into it
+    // waits for the gpu to finish reading it first, which is only a stall if the gpu is PBO_COUNT frames behind
+    uint8_t* Engine::begin_pbo() {
+        GLsync& fence = canvas_pbo_fence[pbo_index];
+        if (fence) {
+            double stall_start = glfwGetTime();
+            GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            // 1ms at a time
+            while (result == GL_TIMEOUT_EXPIRED) result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            upload_stats.stall_ms += (glfwGetTime() - stall_start) * 1000.0;
+            glDeleteSync(fence);
+            fence = 0;
+        }
 
-        // convert to doubles (0 - 1)
-        double or = op.r / 255.0, og = op.g / 255.0, ob = op.b / 255.0, oa = op.a / 255.0;
-        // same with the target pixel
-        double tr = p.r / 255.0, tg = p.g / 255.0, tb = p.b / 255.0, ta = p.a / 255.0;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, canvas_pbo[pbo_index]);
+        if (canvas_pbo_ptr[pbo_index]) return (uint8_t*) canvas_pbo_ptr[pbo_index];
 
-        // premultiply the alphas
-        or *= oa; og *= oa; ob *= oa;
-        tr *= ta; tg *= ta; tb *= ta;
+        // the fence already guarantees the gpu is done with it, so there is no need for the driver to sync too
+        GLsizeiptr size = (GLsizeiptr) canvas_width * canvas_height * sizeof(Pixel);
+        uint8_t* ptr = (uint8_t*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!ptr) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return ptr;
+    }
 
-        // get new alpha
-        double na = ta + (1 - ta) * oa;
+    // unmaps the pixel buffer if needed, call before the glTexSubImage2D calls that read from it
+    void Engine::unmap_pbo() {
+        if (!canvas_pbo_ptr[pbo_index]) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
 
-        // over operator
-        double nr, ng, nb;
-        nr = tr + (1 - ta) * or;
-        ng = tg + (1 - ta) * og;
-        nb = tb + (1 - ta) * ob;
+    // fences the uploads just issued from the pixel buffer and moves to the next one in the ring
+    void Engine::end_pbo() {
+        canvas_pbo_fence[pbo_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pbo_index = (pbo_index + 1) % PBO_COUNT;
+    }
+
+    // uploads the dirty tiles of the canvas to the canvas texture, then marks everything clean
+    void Engine::upload_dirty() {
+        tile_rects(dirty_tiles, upload_rects);
+        upload((const uint8_t*) canvas_sprite->get_data());
+
+        std::fill(dirty_tiles.begin(), dirty_tiles.end(), 0);
+        dirty_count = 0;
+    }
+
+    // turns a mask of canvas tiles into rects, one per horizontal run of set tiles
+    void Engine::tile_rects(const std::vector<uint8_t>& tiles, std::vector<Rect>& rects) {
+        int w = canvas_width;
+        int h = canvas_height;
+
+        rects.clear();
+        int count = (int) std::count(tiles.begin(), tiles.end(), 1);
+        if (count == 0) return;
+        // mostly set, one big rect is cheaper than many small ones
+        if (count * 2 >= (int) tiles.size()) {
+            rects.push_back(Rect(0, 0, w, h));
+            return;
+        }
+        for (int ty = 0; ty < dirty_tiles_y; ty++) {
+            int y0 = ty * TILE_SIZE, y1 = std::min(y0 + TILE_SIZE, h);
+            int tx = 0;
+            while (tx < dirty_tiles_x) {
+                if (!tiles[ty * dirty_tiles_x + tx]) {
+                    tx++;
+                    continue;
+                }
+                int run = tx;
+                while (run < dirty_tiles_x && tiles[ty * dirty_tiles_x + run]) run++;
+                rects.push_back(Rect(tx * TILE_SIZE, y0, std::min(run * TILE_SIZE, w), y1));
+                tx = run;
+            }
+        }
+    }
+
+    // uploads upload_rects of data (a canvas-sized image) to the canvas texture
+    // the rects are copied into a pixel buffer and the texture is updated from it, so the
+    // driver copies asynchronously instead of blocking on the canvas memory
+    void Engine::upload(const uint8_t* data) {
+        PIX2D_TRACE_ZONE("upload");
+        double upload_start = glfwGetTime();
+        int w = canvas_width;
+        int h = canvas_height;
+
+        // copy into the pixel buffer at the same layout as the canvas, so offsets are shared
+        uint8_t* pbo = begin_pbo();
+        if (pbo) {
+            // canvas rows are stored bottom-up, as are the texture rows
+            copy_rects(pbo, data, w, h, upload_rects);
+            unmap_pbo();
+        }
 
-        // divide out the alpha (if alpha is non-zero)
-        if (na > 0) {
-            nr /= na; ng /= na; nb /= na;
+        // with a pixel buffer bound the data pointer is an offset into it
+        const uint8_t* source = pbo ? nullptr : data;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+        for (const Rect& r : upload_rects) {
+            size_t offset = ((size_t) (h - r.y1) * w + r.x0) * sizeof(Pixel);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x0, h - r.y1, r.x1 - r.x0, r.y1 - r.y0, GL_RGBA, GL_UNSIGNED_BYTE, source + offset);
+            upload_stats.bytes += (r.x1 - r.x0) * (r.y1 - r.y0) * (int) sizeof(Pixel);
         }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (pbo) end_pbo();
+
+        upload_stats.upload_ms += (glfwGetTime() - upload_start) * 1000.0;
+    }
 
-        // convert back to ints
-        uint8_t ir, ig, ib, ia;
-        ir = (uint8_t) floor(nr * 255.0);
-        ig = (uint8_t) floor(ng * 255.0);
-        ib = (uint8_t) floor(nb * 255.0);
-        ia = (uint8_t) floor(na * 255.0);
 
-        Pixel np = Pixel(ir, ig, ib, ia);
+    // DRAWING FUNCTIONS
+    // every drawing call is turned into a DrawCommand, which is either recorded for the
+    // tiled rasteriser or executed immediately (see submit)
 
-        canvas_sprite->set_pixel(x, y, np);
+    // draws a point at (x, y)
+    void Engine::point(int x, int y, Pixel p) {
+        PointCommand* cmd = begin_command<PointCommand>(DrawOp::POINT, Rect(x, y, x + 1, y + 1));
+        if (!cmd) return;
+        cmd->x = x; cmd->y = y;
+        cmd->c = p;
+        end_command();
     }
 
     // draws a line from (x1, y1) to (x2, y2)
     void Engine::line(int x1, int y1, int x2, int y2, Pixel p) {
-        // Bresenham's line algorithm
-        int dx = abs(x1 - x2);
-        int dy = -abs(y1 - y2);
-        int sx = x1 < x2 ? 1 : -1;
-        int sy = y1 < y2 ? 1 : -1;
-        int err = dx + dy;
-        while (true) {
-            point(x1, y1, p);
-            if (x1 == x2 && y1 == y2) break;
-            int e2 = 2 * err;
-            if (e2 >= dy) {
-                err += dy;
-                x1 += sx;
-            }
-            if (e2 <= dx) {
-                err += dx;
-                y1 += sy;
-            }
-        }
+        LineCommand* cmd = begin_command<LineCommand>(DrawOp::LINE, Rect(std::min(x1, x2), std::min(y1, y2), std::max(x1, x2) + 1, std::max(y1, y2) + 1));
+        if (!cmd) return;
+        cmd->x1 = x1; cmd->y1 = y1; cmd->x2 = x2; cmd->y2 = y2;
+        cmd->c = p;
+        end_command();
     }
 
     // draws a circle at (x1, y1) with radius r with stroke s, and fill f
     void Engine::circle(int x1, int y1, int r, Pixel s) {
-
+        ellipse(x1, y1, r, r, s);
     }
 
     void Engine::circle(int x1, int y1, int r, Pixel s, Pixel f) {
+        ellipse(x1, y1, r, r, s, f);
+    }
+
+    // draws an ellipse at (x1, y1) with radii rx and ry with stroke s, and fill f
+    void Engine::ellipse(int x1, int y1, int rx, int ry, Pixel s) {
+        if (rx < 0 || ry < 0) return;
+
+        EllipseCommand* cmd = begin_command<EllipseCommand>(DrawOp::ELLIPSE, Rect(x1 - rx, y1 - ry, x1 + rx + 1, y1 + ry + 1));
+        if (!cmd) return;
+        cmd->x = x1; cmd->y = y1; cmd->rx = rx; cmd->ry = ry;
+        cmd->s = s;
+        end_command();
+    }
+
+    void Engine::ellipse(int x1, int y1, int rx, int ry, Pixel s, Pixel f) {
+        if (rx < 0 || ry < 0) return;
 
+        EllipseCommand* cmd = begin_command<EllipseCommand>(DrawOp::ELLIPSE_FILL, Rect(x1 - rx, y1 - ry, x1 + rx + 1, y1 + ry + 1));
+        if (!cmd) return;
+        cmd->x = x1; cmd->y = y1; cmd->rx = rx; cmd->ry = ry;
+        cmd->s = s; cmd->f = f;
+        end_command();
+    }
+
+    // draws the part of the circle at (x1, y1) with radius r from angle start to end (radians, clockwise from +x)
+    void Engine::arc(int x1, int y1, int r, float start, float end, Pixel s) {
+        if (r < 0) return;
+
+        ArcCommand* cmd = begin_command<ArcCommand>(DrawOp::ARC, Rect(x1 - r, y1 - r, x1 + r + 1, y1 + r + 1));
+        if (!cmd) return;
+        cmd->x = x1; cmd->y = y1; cmd->r = r;
+        cmd->start = start; cmd->end = end;
+        cmd->s = s;
+        end_command();
     }
 
     // draws a rect at (x1, y1) to (x1 + w, y1 + h) with stroke s and fill f
     void Engine::rect(int x1, int y1, int w, int h, Pixel s) {
-        // draw the edges
-        for (int x = x1; x < x1 + w; x++) {
-            point(x, y1, s);
-            point(x, y1 + h - 1, s);
+        RectCommand* cmd = begin_command<RectCommand>(DrawOp::RECT, Rect(x1, y1, x1 + w, y1 + h));
+        if (!cmd) return;
+        cmd->x = x1; cmd->y = y1; cmd->w = w; cmd->h = h;
+        cmd->s = s;
+        end_command();
+    }
+
+    void Engine::rect(int x1, int y1, int w, int h, Pixel s, Pixel f) {
+        // a rect whose stroke and fill match is one solid fill, which can be merged with its neighbours
+        bool solid = s.r == f.r && s.g == f.g && s.b == f.b && s.a == f.a;
+
+        RectCommand* cmd = begin_command<RectCommand>(solid ? DrawOp::FILL : DrawOp::RECT_FILL, Rect(x1, y1, x1 + w, y1 + h));
+        if (!cmd) return;
+        cmd->x = x1; cmd->y = y1; cmd->w = w; cmd->h = h;
+        cmd->s = s; cmd->f = f;
+
+        // fills store their clipped rect, so merging neighbours can't grow them outside the clip
+        if (solid && !clip_stack.empty()) {
+            Rect r = Rect(x1, y1, x1 + w, y1 + h).intersect(clip_stack.back());
+            cmd->x = r.x0; cmd->y = r.y0; cmd->w = r.x1 - r.x0; cmd->h = r.y1 - r.y0;
         }
-        for (int y = y1 + 1; y < y1 + h - 1; y++) {
-            point(x1, y, s);
-            point(x1 + w - 1, y, s);
+        end_command();
+    }
+
+    // draws a triangle using points (x1, y1), (x2, y2), (x3, y3) with stroke s and fill f
+    void Engine::triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s) {
+        Rect bounds = Rect(std::min({ x1, x2, x3 }), std::min({ y1, y2, y3 }), std::max({ x1, x2, x3 }) + 1, std::max({ y1, y2, y3 }) + 1);
+        TriangleCommand* cmd = begin_command<TriangleCommand>(DrawOp::TRIANGLE, bounds);
+        if (!cmd) return;
+        cmd->x1 = x1; cmd->y1 = y1; cmd->x2 = x2; cmd->y2 = y2; cmd->x3 = x3; cmd->y3 = y3;
+        cmd->s = s;
+        end_command();
+    }
+
+    void Engine::triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s, Pixel f) {
+        Rect bounds = Rect(std::min({ x1, x2, x3 }), std::min({ y1, y2, y3 }), std::max({ x1, x2, x3 }) + 1, std::max({ y1, y2, y3 }) + 1);
+        TriangleCommand* cmd = begin_command<TriangleCommand>(DrawOp::TRIANGLE_FILL, bounds);
+        if (!cmd) return;
+        cmd->x1 = x1; cmd->y1 = y1; cmd->x2 = x2; cmd->y2 = y2; cmd->x3 = x3; cmd->y3 = y3;
+        cmd->s = s; cmd->f = f;
+        end_command();
+    }
+
+    // fills a mesh of triangles with f, indices holds three vertex indices per triangle
+    // recorded as one command, so thousands of triangles cost one command rather than thousands
+    void Engine::triangles(const std::vector<glm::ivec2>& vertices, const std::vector<uint32_t>& indices, Pixel f) {
+        if (vertices.empty() || indices.size() < 3) return;
+
+        Rect bounds = Rect(vertices[0].x, vertices[0].y, vertices[0].x, vertices[0].y);
+        for (auto& v : vertices) {
+            bounds.x0 = std::min(bounds.x0, v.x); bounds.y0 = std::min(bounds.y0, v.y);
+            bounds.x1 = std::max(bounds.x1, v.x); bounds.y1 = std::max(bounds.y1, v.y);
         }
+
+        uint32_t vertex_bytes = (uint32_t) (vertices.size() * sizeof(glm::ivec2));
+        uint32_t index_count = (uint32_t) (indices.size() / 3 * 3);
+        MeshCommand* cmd = begin_command<MeshCommand>(DrawOp::MESH, bounds, vertex_bytes + index_count * sizeof(uint32_t));
+        if (!cmd) return;
+        cmd->f = f;
+        cmd->vertex_count = (uint32_t) vertices.size();
+        cmd->index_count = index_count;
+        uint8_t* data = reinterpret_cast<uint8_t*>(cmd + 1);
+        memcpy(data, vertices.data(), vertex_bytes);
+        memcpy(data + vertex_bytes, indices.data(), index_count * sizeof(uint32_t));
+        end_command();
     }
 
-    void Engine::rect(int x1, int y1, int w, int h, Pixel s, Pixel f) {
+    // draws a sprite at (x, y)
+    void Engine::draw_sprite(int x, int y, Sprite* sprite) {
+        if (!sprite || !sprite->get_data()) return;
 
-        // draw the inside (offset by 1 to include the edges)
-        for (int x = x1 + 1; x < x1 + w - 1; x++) {
-            for (int y = y1 + 1; y < y1 + h - 1; y++) {
-                point(x, y, f);
+        SpriteCommand* cmd = begin_command<SpriteCommand>(DrawOp::SPRITE, Rect(x, y, x + sprite->get_width(), y + sprite->get_height()));
+        if (!cmd) return;
+        cmd->x = x; cmd->y = y;
+        cmd->sprite = sprite;
+        end_command();
+    }
+
+    void Engine::draw_sprite(int x, int y, const RleSprite* sprite) {
+        if (!sprite) return;
+
+        RleSpriteCommand* cmd = begin_command<RleSpriteCommand>(DrawOp::SPRITE_RLE, Rect(x, y, x + sprite->get_width(), y + sprite->get_height()));
+        if (!cmd) return;
+        cmd->x = x; cmd->y = y;
+        cmd->sprite = sprite;
+        end_command();
+    }
+
+    // draws a sprite through transform, which maps sprite coordinates ((0, 0) is its top left corner) to the canvas
+    void Engine::draw_sprite_transformed(Sprite* sprite, const glm::mat3& transform, Sampling sampling) {
+        if (!sprite || !sprite->get_data()) return;
+        int w = sprite->get_width(), h = sprite->get_height();
+        if (w > SAMPLE_MAX_SIZE || h > SAMPLE_MAX_SIZE) return;
+
+        // glm is column major, x' = a x + b y + c and y' = d x + e y + f
+        double a = transform[0][0], b = transform[1][0], c = transform[2][0];
+        double d = transform[0][1], e = transform[1][1], f = transform[2][1];
+        double det = a * e - b * d;
+        if (fabs(det) < 1e-12) return;
+
+        // bounding box of the transformed corners
+        double xs[4] = { c, a * w + c, b * h + c, a * w + b * h + c };
+        double ys[4] = { f, d * w + f, e * h + f, d * w + e * h + f };
+        double x0 = std::min({ xs[0], xs[1], xs[2], xs[3] }), x1 = std::max({ xs[0], xs[1], xs[2], xs[3] });
+        double y0 = std::min({ ys[0], ys[1], ys[2], ys[3] }), y1 = std::max({ ys[0], ys[1], ys[2], ys[3] });
+        if (x0 < INT_MIN / 2 || x1 > INT_MAX / 2 || y0 < INT_MIN / 2 || y1 > INT_MAX / 2) return;
+        Rect bounds = Rect((int) floor(x0), (int) floor(y0), (int) ceil(x1), (int) ceil(y1));
+
+        TransformedSpriteCommand* cmd = begin_command<TransformedSpriteCommand>(DrawOp::SPRITE_TRANSFORMED, bounds);
+        if (!cmd) return;
+        cmd->sprite = sprite;
+        // inverted once here, not per tile
+        cmd->u[0] = e / det; cmd->u[1] = -b / det; cmd->u[2] = (b * f - e * c) / det;
+        cmd->v[0] = -d / det; cmd->v[1] = a / det; cmd->v[2] = (d * c - a * f) / det;
+        cmd->sampling = sampling;
+        end_command();
+    }
+
+    // draws text at (x, y) with fill c
+    void Engine::text(int x, int y, int scale, const std::string& text, Pixel c) {
+        // measure the text so it can be culled and binned
+        glm::ivec2 size = measure_text(scale, text);
+
+        TextCommand* cmd = begin_command<TextCommand>(DrawOp::TEXT, Rect(x, y, x + size.x, y + size.y), (uint32_t) text.size());
+        if (!cmd) return;
+        cmd->x = x; cmd->y = y;
+        cmd->scale = scale;
+        cmd->c = c;
+        cmd->length = (uint32_t) text.size();
+        memcpy(cmd + 1, text.data(), text.size());
+        end_command();
+    }
+
+    // draws utf-8 text with font at pixel height size, (x, y) is the top left of the first line
+    void Engine::text(int x, int y, Font* font, int size, const std::string& text, Pixel c) {
+        if (!font || !font->is_loaded() || size <= 0) return;
+        Engine::text(x, y, *layout_text(font, size, text, 0, false), c);
+    }
+
+    // draws a layout made by layout_text with its top left corner at (x, y)
+    // the glyphs are already placed, so this only copies them into the command
+    void Engine::text(int x, int y, const TextLayout& layout, Pixel c) {
+        if (!layout.font || layout.glyphs.empty()) return;
+        // nothing is rasterised while drawing calls are made, so this is where old glyphs can go
+        glyph_atlas.trim();
+
+        const Rect& ink = layout.ink;
+        uint32_t count = (uint32_t) layout.glyphs.size();
+        FontTextCommand* cmd = begin_command<FontTextCommand>(DrawOp::FONT_TEXT, Rect(x + ink.x0, y + ink.y0, x + ink.x1, y + ink.y1), count * sizeof(PlacedGlyph));
+        if (!cmd) return;
+        cmd->x = x; cmd->y = y;
+        cmd->size = layout.size;
+        cmd->font = layout.font;
+        cmd->c = c;
+        cmd->count = count;
+        memcpy(reinterpret_cast<uint8_t*>(cmd + 1), layout.glyphs.data(), count * sizeof(PlacedGlyph));
+        end_command();
+    }
+
+    // lays out text inside rect and draws it there, clipped to rect
+    void Engine::text(const Rect& rect, Font* font, int size, const std::string& text, Pixel c, bool wrap, TextAlign align) {
+        if (!font || !font->is_loaded() || size <= 0 || rect.empty()) return;
+        push_clip(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+        Engine::text(rect.x0, rect.y0, *layout_text(font, size, text, rect.x1 - rect.x0, wrap, align), c);
+        pop_clip();
+    }
+
+    // width of the widest line and height of all the lines of text, as text() would draw it
+    glm::ivec2 Engine::measure_text(int scale, const std::string& text) {
+        int lines = 1, columns = 0, col = 0;
+        for (auto &ch : text) {
+            if (ch == '\n') {
+                lines++;
+                col = 0;
+            } else {
+                columns = std::max(columns, ++col);
             }
         }
+        int size = CHAR_SIZE * scale;
+        return glm::ivec2(columns * size, lines * size);
+    }
+
+    glm::ivec2 Engine::measure_text(Font* font, int size, const std::string& text, int wrap_width) {
+        if (!font || !font->is_loaded() || size <= 0) return glm::ivec2(0, 0);
+        auto layout = layout_text(font, size, text, wrap_width, wrap_width > 0);
+        return glm::ivec2(layout->width, layout->height);
+    }
+
+    // breaks text into lines at most width wide, at spaces if wrap is set, and aligns each line inside width
+    std::shared_ptr<const TextLayout> Engine::layout_text(Font* font, int size, const std::string& text, int width, bool wrap, TextAlign align) {
+        static const std::shared_ptr<const TextLayout> empty = std::make_shared<TextLayout>();
+        if (!font || !font->is_loaded() || size <= 0) return empty;
+        return glyph_atlas.layout(font, size, text.data(), (int) text.size(), width, wrap, align);
+    }
+
+    // clears the screen with fill c
+    void Engine::clear(Pixel c) {
+        // a clipped clear only replaces the clip rect, so unlike CLEAR it can't drop what was drawn before it
+        if (!clip_stack.empty()) {
+            const Rect& r = clip_stack.back();
+            RectCommand* cmd = begin_command<RectCommand>(DrawOp::FILL, BlendMode::REPLACE, r);
+            if (!cmd) return;
+            cmd->x = r.x0; cmd->y = r.y0; cmd->w = r.x1 - r.x0; cmd->h = r.y1 - r.y0;
+            cmd->s = c; cmd->f = c;
+            end_command();
+            return;
+        }
 
-        // draw the edges
-        for (int x = x1; x < x1 + w; x++) {
-            point(x, y1, s);
-            point(x, y1 + h - 1, s);
+        ClearCommand* cmd = begin_command<ClearCommand>(DrawOp::CLEAR, canvas_rect());
+        if (!cmd) return;
+        cmd->c = c;
+        end_command();
+    }
+
+
+    // sets the blend mode used by all following drawing calls
+    void Engine::set_blend_mode(BlendMode mode) {
+        blend_mode = mode;
+    }
+
+    BlendMode Engine::get_blend_mode() {
+        return blend_mode;
+    }
+
+    // limits all following drawing calls to the rect (x, y) to (x + w - 1, y + h - 1), inside any clip already pushed
+    // every call is clipped once when it is made, so recorded commands keep the clip they were drawn with
+    void Engine::push_clip(int x, int y, int w, int h) {
+        Rect r = Rect(x, y, x + w, y + h);
+        if (!clip_stack.empty()) r = r.intersect(clip_stack.back());
+        clip_stack.push_back(r);
+    }
+
+    // goes back to the clip before the last push_clip
+    void Engine::pop_clip() {
+        if (!clip_stack.empty()) clip_stack.pop_back();
+    }
+
+    // marks the canvas area (x, y) to (x + w - 1, y + h - 1) as changed
+    // only needed after writing to canvas_sprite directly, the drawing functions do this themselves
+    void Engine::mark_dirty(int x, int y, int w, int h) {
+        mark_dirty(Rect(x, y, x + w, y + h));
+    }
+
+    // records all following drawing calls into buffer instead of drawing them, nullptr goes back to drawing
+    void Engine::record(CommandBuffer* buffer) {
+        user_commands = buffer;
+    }
+
+    // draws every command in buffer, or appends them to the buffer being recorded into
+    void Engine::replay(const CommandBuffer& buffer) {
+        CommandBuffer* target = recording_target();
+        if (target) {
+            if (target != &buffer) target->append(buffer);
+            return;
         }
-        for (int y = y1 + 1; y < y1 + h - 1; y++) {
-            point(x1, y, s);
-            point(x1 + w - 1, y, s);
+
+        if (!canvas_sprite) return;
+        for (auto& cmd : buffer) {
+            execute(cmd, canvas_rect());
+            mark_dirty(cmd.bounds);
         }
+        last_frame_valid = false;
     }
 
-    // draws a triangle using points (x1, y1), (x2, y2), (x3, y3) with stroke s and fill f
-    void Engine::triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s) {
 
+    // DRAWING INTERNALS
+    // the buffer drawing calls are recorded into, nullptr when drawing immediately
+    CommandBuffer* Engine::recording_target() {
+        if (user_commands) return user_commands;
+        if (recording_frame) return &frame_commands;
+        return nullptr;
     }
 
-    void Engine::triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s, Pixel f) {
+    // starts a command for op with the current draw state
+    // goes into the buffer being recorded into, or a scratch buffer when drawing immediately
+    template <typename T>
+    T* Engine::begin_command(DrawOp op, const Rect& bounds, uint32_t extra) {
+        return begin_command<T>(op, blend_mode, bounds, extra);
+    }
 
+    // the bounds are clipped here, once per command, and execute() never draws outside them
+    template <typename T>
+    T* Engine::begin_command(DrawOp op, BlendMode mode, const Rect& bounds, uint32_t extra) {
+        Rect b = bounds;
+        if (!clip_stack.empty()) {
+            b = b.intersect(clip_stack.back());
+            if (b.empty()) return nullptr;
+        }
+
+        CommandBuffer* target = recording_target();
+        if (!target) target = &immediate_commands;
+        return target->push<T>(op, mode, b, extra);
     }
 
-    // draws a sprite at (x, y)
-    void Engine::draw_sprite(int x, int y, Sprite* sprite) {
-        for (int i = 0; i < sprite->get_width(); i++) {
-            for (int j = 0; j < sprite->get_height(); j++) {
-                point(x + i, y + j, sprite->get_pixel(i, j));
+    // draws the command just started, unless it is being recorded
+    void Engine::end_command() {
+        if (recording_target()) return;
+
+        if (canvas_sprite) {
+            for (auto& cmd : immediate_commands) {
+                execute(cmd, canvas_rect());
+                mark_dirty(cmd.bounds);
             }
+            last_frame_valid = false;
         }
+        immediate_commands.clear();
     }
 
-    // draws text at (x, y) with fill c
-    void Engine::text(int x, int y, int scale, const std::string& text, Pixel c) {
+    // draws cmd, touching only pixels inside clip and its bounds
+    void Engine::execute(const CommandHeader& cmd, const Rect& area) {
+        Rect clip = area.intersect(cmd.bounds);
+        if (clip.empty()) return;
+
+        switch (cmd.op) {
+            case DrawOp::POINT: {
+                const PointCommand* p = cmd.payload<PointCommand>();
+                raster_point(clip, p->x, p->y, p->c, cmd.mode);
+                break;
+            }
+            case DrawOp::LINE: {
+                const LineCommand* l = cmd.payload<LineCommand>();
+                raster_line(clip, l->x1, l->y1, l->x2, l->y2, l->c, cmd.mode);
+                break;
+            }
+            case DrawOp::RECT: {
+                const RectCommand* r = cmd.payload<RectCommand>();
+                raster_rect(clip, r->x, r->y, r->w, r->h, r->s, cmd.mode);
+                break;
+            }
+            case DrawOp::RECT_FILL: {
+                // draw the inside (offset by 1 to include the edges), then the edges
+                const RectCommand* r = cmd.payload<RectCommand>();
+                BlendMode fill_mode = cmd.mode;
+                if (resolve_mode(fill_mode, r->f)) fill_rect(clip, r->x + 1, r->y + 1, r->w - 2, r->h - 2, r->f, fill_mode);
+                raster_rect(clip, r->x, r->y, r->w, r->h, r->s, cmd.mode);
+                break;
+            }
+            case DrawOp::FILL: {
+                const RectCommand* r = cmd.payload<RectCommand>();
+                BlendMode fill_mode = cmd.mode;
+                if (resolve_mode(fill_mode, r->f)) fill_rect(clip, r->x, r->y, r->w, r->h, r->f, fill_mode);
+                break;
+            }
+            case DrawOp::SPRITE: {
+                const SpriteCommand* s = cmd.payload<SpriteCommand>();
+                raster_sprite(clip, s->x, s->y, s->sprite, cmd.mode);
+                break;
+            }
+            case DrawOp::SPRITE_RLE: {
+                const RleSpriteCommand* s = cmd.payload<RleSpriteCommand>();
+                raster_rle_sprite(clip, s->x, s->y, s->sprite, cmd.mode);
+                break;
+            }
+            case DrawOp::SPRITE_TRANSFORMED: {
+                raster_sprite_transformed(clip, *cmd.payload<TransformedSpriteCommand>(), cmd.mode);
+                break;
+            }
+            case DrawOp::TEXT: {
+                const TextCommand* t = cmd.payload<TextCommand>();
+                raster_text(clip, t->x, t->y, t->scale, reinterpret_cast<const char*>(t + 1), (int) t->length, t->c, cmd.mode);
+                break;
+            }
+            case DrawOp::FONT_TEXT: {
+                const FontTextCommand* t = cmd.payload<FontTextCommand>();
+                raster_font_text(clip, *t, reinterpret_cast<const PlacedGlyph*>(t + 1), cmd.mode);
+                break;
+            }
+            case DrawOp::TRIANGLE: {
+                const TriangleCommand* t = cmd.payload<TriangleCommand>();
+                raster_triangle(clip, t->x1, t->y1, t->x2, t->y2, t->x3, t->y3, t->s, cmd.mode);
+                break;
+            }
+            case DrawOp::TRIANGLE_FILL: {
+                // the fill without the outline's pixels, then the outline
+                const TriangleCommand* t = cmd.payload<TriangleCommand>();
+                BlendMode fill_mode = cmd.mode;
+                if (resolve_mode(fill_mode, t->f)) fill_triangle(clip, t->x1, t->y1, t->x2, t->y2, t->x3, t->y3, t->f, fill_mode, true);
+                raster_triangle(clip, t->x1, t->y1, t->x2, t->y2, t->x3, t->y3, t->s, cmd.mode);
+                break;
+            }
+            case DrawOp::MESH: {
+                const MeshCommand* m = cmd.payload<MeshCommand>();
+                const glm::ivec2* vertices = reinterpret_cast<const glm::ivec2*>(m + 1);
+                const uint32_t* indices = reinterpret_cast<const uint32_t*>(vertices + m->vertex_count);
+                raster_mesh(clip, vertices, m->vertex_count, indices, m->index_count, m->f, cmd.mode);
+                break;
+            }
+            case DrawOp::ELLIPSE: {
+                const EllipseCommand* e = cmd.payload<EllipseCommand>();
+                raster_ellipse(clip, e->x, e->y, e->rx, e->ry, e->s, nullptr, cmd.mode);
+                break;
+            }
+            case DrawOp::ELLIPSE_FILL: {
+                const EllipseCommand* e = cmd.payload<EllipseCommand>();
+                raster_ellipse(clip, e->x, e->y, e->rx, e->ry, e->s, &e->f, cmd.mode);
+                break;
+            }
+            case DrawOp::ARC: {
+                const ArcCommand* a = cmd.payload<ArcCommand>();
+                raster_arc(clip, a->x, a->y, a->r, a->start, a->end, a->s, cmd.mode);
+                break;
+            }
+            case DrawOp::CLEAR: {
+                // clearing ignores the blend mode
+                const ClearCommand* c = cmd.payload<ClearCommand>();
+                fill_rect(clip, clip.x0, clip.y0, clip.x1 - clip.x0, clip.y1 - clip.y0, c->c, BlendMode::REPLACE);
+                break;
+            }
+        }
+    }
+
+    // true if every pixel cmd writes gets a value that doesn't depend on what was there
+    // solid colours drawn opaque in ALPHA or PREMULTIPLIED mode resolve to REPLACE, sprites and coverage text blend
+    static bool overwrites(const CommandHeader& cmd) {
+        if (cmd.op == DrawOp::CLEAR) return true;
+        if (cmd.mode == BlendMode::REPLACE) return cmd.op != DrawOp::FONT_TEXT;
+        if (cmd.mode != BlendMode::ALPHA && cmd.mode != BlendMode::PREMULTIPLIED) return false;
+
+        switch (cmd.op) {
+            case DrawOp::POINT: return cmd.payload<PointCommand>()->c.a == 255;
+            case DrawOp::LINE: return cmd.payload<LineCommand>()->c.a == 255;
+            case DrawOp::RECT: return cmd.payload<RectCommand>()->s.a == 255;
+            case DrawOp::FILL: return cmd.payload<RectCommand>()->f.a == 255;
+            case DrawOp::RECT_FILL: return cmd.payload<RectCommand>()->s.a == 255 && cmd.payload<RectCommand>()->f.a == 255;
+            case DrawOp::TEXT: return cmd.payload<TextCommand>()->c.a == 255;
+            case DrawOp::TRIANGLE: return cmd.payload<TriangleCommand>()->s.a == 255;
+            case DrawOp::TRIANGLE_FILL: return cmd.payload<TriangleCommand>()->s.a == 255 && cmd.payload<TriangleCommand>()->f.a == 255;
+            case DrawOp::MESH: return cmd.payload<MeshCommand>()->f.a == 255;
+            case DrawOp::ELLIPSE: return cmd.payload<EllipseCommand>()->s.a == 255;
+            case DrawOp::ELLIPSE_FILL: return cmd.payload<EllipseCommand>()->s.a == 255 && cmd.payload<EllipseCommand>()->f.a == 255;
+            case DrawOp::ARC: return cmd.payload<ArcCommand>()->s.a == 255;
+            default: return false;
+        }
+    }
+
+    // true if drawing buffer a second time over its own result changes nothing
+    // that holds when it starts by clearing the whole canvas (a CLEAR empties the buffer before it, so it can only be first),
+    // or when no command reads the pixels it writes
+    static bool redraw_is_idempotent(const CommandBuffer& buffer) {
+        if (buffer.empty()) return true;
+        if (buffer.begin()->op == DrawOp::CLEAR) return true;
+        for (auto& cmd : buffer) {
+            if (!overwrites(cmd)) return false;
+        }
+        return true;
+    }
+
+    // rasterises the commands recorded during update()
+    void Engine::flush_commands() {
+        if (!deferred && !threaded_raster) return;
+        PIX2D_TRACE_ZONE("raster");
+        if (!canvas_sprite) {
+            frame_commands.clear();
+            return;
+        }
+
+        frame_commands.cull(canvas_rect());
+        frame_commands.merge();
+
+        // same commands as last frame, and nothing else touched the canvas since, so it already holds the result
+        // only if drawing them again would give the same pixels, blended draws without a clear build up every frame
+        if (skip_identical_frames && last_frame_valid && frame_commands == last_frame_commands && redraw_is_idempotent(frame_commands)) {
+            frame_commands.clear();
+            return;
+        }
+
+        for (auto& cmd : frame_commands) mark_dirty(cmd.bounds);
+
+        if (threaded_raster) {
+            raster_tiled(frame_commands);
+        } else {
+            for (auto& cmd : frame_commands) execute(cmd, canvas_rect());
+        }
+
+        // keep this frame around to compare the next one against
+        frame_commands.swap(last_frame_commands);
+        frame_commands.clear();
+        last_frame_valid = true;
+    }
+
+    // bins the commands into screen tiles, then draws each tile on the worker pool
+    // commands in a tile run in stream order, so the result matches drawing them serially
+    void Engine::raster_tiled(const CommandBuffer& buffer) {
+        Rect canvas = canvas_rect();
+        int tiles_x = (canvas.x1 + TILE_SIZE - 1) / TILE_SIZE;
+        int tiles_y = (canvas.y1 + TILE_SIZE - 1) / TILE_SIZE;
+
+        tile_bins.resize(tiles_x * tiles_y);
+        for (auto& bin : tile_bins) bin.clear();
+
+        for (auto& cmd : buffer) {
+            Rect b = cmd.bounds.intersect(canvas);
+            if (b.empty()) continue;
+
+            uint32_t offset = buffer.offset_of(cmd);
+            for (int ty = b.y0 / TILE_SIZE; ty <= (b.y1 - 1) / TILE_SIZE; ty++) {
+                for (int tx = b.x0 / TILE_SIZE; tx <= (b.x1 - 1) / TILE_SIZE; tx++) {
+                    tile_bins[ty * tiles_x + tx].push_back(offset);
+                }
+            }
+        }
+
+        if (!raster_pool) raster_pool = new WorkerPool(raster_threads);
+
+        raster_pool->run((int) tile_bins.size(), [&](int t) {
+            if (tile_bins[t].empty()) return;
+            PIX2D_TRACE_ZONE("tile");
+
+            int tx = (t % tiles_x) * TILE_SIZE;
+            int ty = (t / tiles_x) * TILE_SIZE;
+            Rect tile = Rect(tx, ty, tx + TILE_SIZE, ty + TILE_SIZE).intersect(canvas);
+
+            for (uint32_t offset : tile_bins[t]) execute(*buffer.at(offset), tile);
+        });
+    }
+
+    // marks the tiles overlapping r as needing an upload
+    void Engine::mark_dirty(const Rect& r) {
+        Rect b = r.intersect(canvas_rect());
+        if (b.empty() || dirty_tiles.empty()) return;
+
+        for (int ty = b.y0 / TILE_SIZE; ty <= (b.y1 - 1) / TILE_SIZE; ty++) {
+            for (int tx = b.x0 / TILE_SIZE; tx <= (b.x1 - 1) / TILE_SIZE; tx++) {
+                uint8_t& tile = dirty_tiles[ty * dirty_tiles_x + tx];
+                if (!tile) {
+                    tile = 1;
+                    dirty_count++;
+                }
+            }
+        }
+    }
+
+    // the whole canvas as a rect
+    Rect Engine::canvas_rect() {
+        if (!canvas_sprite) return Rect();
+        return Rect(0, 0, canvas_sprite->get_width(), canvas_sprite->get_height());
+    }
+
+    // draws a point at (x, y)
+    void Engine::raster_point(const Rect& clip, int x, int y, Pixel p, BlendMode mode) {
+        if (!resolve_mode(mode, p)) return;
+        plot(clip, x, y, p, mode);
+    }
+
+    // floor(a / b) for b > 0
+    static inline int64_t floor_div(int64_t a, int64_t b) {
+        return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    // steps t >= 0 along direction d from s that land inside [c0, c1)
+    static inline void clip_steps(int s, int d, int c0, int c1, int64_t& lo, int64_t& hi) {
+        if (d > 0) {
+            lo = (int64_t) c0 - s;
+            hi = (int64_t) c1 - 1 - s;
+        } else {
+            lo = (int64_t) s - c1 + 1;
+            hi = (int64_t) s - c0;
+        }
+    }
+
+    // the pixels raster_line draws on row y, which are always one run from rx0 to rx1, false if there are none
+    static bool line_row_run(int x1, int y1, int x2, int y2, bool skip_last, int y, int& rx0, int& rx1) {
+        int sx = x1 < x2 ? 1 : -1;
+        int sy = y1 < y2 ? 1 : -1;
+        bool x_major = abs(x2 - x1) >= abs(y2 - y1);
+        int64_t n = x_major ? abs(x2 - x1) : abs(y2 - y1);
+        int64_t m = x_major ? abs(y2 - y1) : abs(x2 - x1);
+        int64_t last = skip_last ? n - 1 : n;
+
+        if (!x_major) {
+            // one pixel per row
+            int64_t i = (int64_t) sy * (y - y1);
+            if (i < 0 || i > last) return false;
+            rx0 = rx1 = x1 + sx * (int) ((2 * m * i + n) / (2 * n));
+            return true;
+        }
+
+        // the steps whose minor position is row y
+        int64_t k = (int64_t) sy * (y - y1);
+        int64_t i0 = 0, i1 = last;
+        if (m == 0) {
+            if (k != 0) return false;
+        } else {
+            if (k < 0 || k > m) return false;
+            i0 = std::max<int64_t>(i0, -floor_div(n - 2 * n * k, 2 * m));
+            i1 = std::min(i1, floor_div(2 * n * (k + 1) - n - 1, 2 * m));
+        }
+        if (i0 > i1) return false;
+        rx0 = x1 + sx * (int) i0;
+        rx1 = x1 + sx * (int) i1;
+        if (rx0 > rx1) std::swap(rx0, rx1);
+        return true;
+    }
+
+    // draws a line from (x1, y1) to (x2, y2)
+    // the same pixels as Bresenham's algorithm: step i along the major axis (length n) moves
+    // floor((2 * m * i + n) / (2 * n)) steps along the minor axis (length m)
+    // that gives the steps inside the clip directly (Liang-Barsky on the integer line), so the walk needs no checks
+    void Engine::raster_line(const Rect& clip, int x1, int y1, int x2, int y2, Pixel p, BlendMode mode, bool skip_last) {
+        if (!resolve_mode(mode, p)) return;
+
+        int sx = x1 < x2 ? 1 : -1;
+        int sy = y1 < y2 ? 1 : -1;
+        bool x_major = abs(x2 - x1) >= abs(y2 - y1);
+        int n = x_major ? abs(x2 - x1) : abs(y2 - y1);
+        int m = x_major ? abs(y2 - y1) : abs(x2 - x1);
+
+        // steps whose major coordinate is inside the clip
+        int64_t i0, i1;
+        if (x_major) clip_steps(x1, sx, clip.x0, clip.x1, i0, i1);
+        else clip_steps(y1, sy, clip.y0, clip.y1, i0, i1);
+        i0 = std::max<int64_t>(i0, 0);
+        i1 = std::min<int64_t>(i1, skip_last ? n - 1 : n);
+
+        // narrowed to the steps whose minor coordinate is inside the clip
+        int64_t k0, k1;
+        if (x_major) clip_steps(y1, sy, clip.y0, clip.y1, k0, k1);
+        else clip_steps(x1, sx, clip.x0, clip.x1, k0, k1);
+        if (m == 0) {
+            if (k0 > 0 || k1 < 0) return;
+        } else {
+            i0 = std::max(i0, -floor_div(n - 2 * (int64_t) n * k0, 2 * (int64_t) m));
+            i1 = std::min(i1, floor_div(2 * (int64_t) n * (k1 + 1) - n - 1, 2 * (int64_t) m));
+        }
+        if (i0 > i1) return;
+
+        // minor position of the first step, and the error term carried between steps
+        int64_t den = 2 * (int64_t) n;
+        int64_t num = 2 * (int64_t) m * i0 + n;
+        int k = n ? (int) (num / den) : 0;
+        int64_t rem = n ? num % den : 0;
+
+        int x = x_major ? x1 + sx * (int) i0 : x1 + sx * k;
+        int y = x_major ? y1 + sy * k : y1 + sy * (int) i0;
+
+        // rows are stored bottom-up, so moving down the canvas moves back a row in memory
+        int cw = canvas_sprite->get_width();
+        ptrdiff_t major_step = x_major ? sx : -sy * (ptrdiff_t) cw;
+        ptrdiff_t minor_step = x_major ? -sy * (ptrdiff_t) cw : sx;
+
+        Pixel* d = canvas_sprite->get_row(y) + x;
+        // the mode is switched on once, the walk is compiled per mode
+        dispatch_mode(mode, [&](auto blender) {
+            for (int64_t i = i0; ; i++) {
+                *d = blender.apply(*d, p);
+                if (i == i1) break;
+
+                d += major_step;
+                rem += 2 * m;
+                if (rem >= den) {
+                    rem -= den;
+                    d += minor_step;
+                }
+            }
+        });
+    }
+
+    // draws the outline of the rect at (x1, y1) with size (w, h), each pixel exactly once
+    void Engine::raster_rect(const Rect& clip, int x1, int y1, int w, int h, Pixel s, BlendMode mode) {
+        if (w <= 0 || h <= 0) return;
+        if (!resolve_mode(mode, s)) return;
+
+        fill_rect(clip, x1, y1, w, 1, s, mode);
+        if (h > 1) fill_rect(clip, x1, y1 + h - 1, w, 1, s, mode);
+        if (h > 2) {
+            fill_rect(clip, x1, y1 + 1, 1, h - 2, s, mode);
+            if (w > 1) fill_rect(clip, x1 + w - 1, y1 + 1, 1, h - 2, s, mode);
+        }
+    }
+
+    // draws the outline of the triangle, each edge leaves out its end so the corners are only drawn once
+    void Engine::raster_triangle(const Rect& clip, int x1, int y1, int x2, int y2, int x3, int y3, Pixel s, BlendMode mode) {
+        raster_line(clip, x1, y1, x2, y2, s, mode, true);
+        raster_line(clip, x2, y2, x3, y3, s, mode, true);
+        raster_line(clip, x3, y3, x1, y1, s, mode, true);
+
+        // all three corners in one place
+        if (x1 == x2 && x2 == x3 && y1 == y2 && y2 == y3) raster_point(clip, x1, y1, s, mode);
+    }
+
+    // fills the triangle with an already resolved mode, covering the pixels whose centres are inside it
+    // a centre exactly on an edge only counts for top and left edges (the top-left rule), so triangles
+    // sharing an edge never both draw it
+    // each edge function is solved for the covered x range once per row, which gives one span per row
+    // skip_outline leaves out the pixels raster_triangle draws, so a stroke over the fill never blends twice
+    void Engine::fill_triangle(const Rect& clip, int x1, int y1, int x2, int y2, int x3, int y3, Pixel c, BlendMode mode, bool skip_outline) {
+        // the outline's edges in the order raster_triangle draws them, before the winding is changed
+        const int ox[3] = { x1, x2, x3 }, oy[3] = { y1, y2, y3 };
+
+        // twice the signed area, flipped to clockwise on screen (y down) so the inside is where every edge function is positive
+        int64_t area = (int64_t) (x2 - x1) * (y3 - y1) - (int64_t) (y2 - y1) * (x3 - x1);
+        if (area == 0) return;
+        if (area < 0) {
+            std::swap(x2, x3);
+            std::swap(y2, y3);
+        }
+
+        // rows whose centres are inside the triangle's vertical extent
+        int ry0 = std::max(std::min({ y1, y2, y3 }), clip.y0);
+        int ry1 = std::min(std::max({ y1, y2, y3 }), clip.y1);
+        if (ry0 >= ry1 || clip.x0 >= clip.x1) return;
+
+        // edge a -> b at the pixel centre (x, y), in doubled coordinates so the centres are integers:
+        // (bx - ax) * (2y + 1 - 2ay) - (by - ay) * (2x + 1 - 2ax), less 1 for edges that aren't top or left
+        // stored as value at (0, ry0), step per x and step per row
+        struct Edge { int64_t c, step_x, step_y; };
+        const int px[3] = { x1, x2, x3 }, py[3] = { y1, y2, y3 };
+        Edge edges[3];
+        for (int k = 0; k < 3; k++) {
+            int ax = px[k], ay = py[k], bx = px[(k + 1) % 3], by = py[(k + 1) % 3];
+            int64_t dx = bx - ax, dy = by - ay;
+            bool top_left = dy < 0 || (dy == 0 && dx > 0);
+            edges[k].c = dx * (2 * (int64_t) ry0 + 1 - 2 * (int64_t) ay) - dy * (1 - 2 * (int64_t) ax) - (top_left ? 0 : 1);
+            edges[k].step_x = -2 * dy;
+            edges[k].step_y = 2 * dx;
+        }
+
+        int cw = canvas_sprite->get_width();
+        Pixel* row = canvas_sprite->get_row(ry0);
+        for (int y = ry0; y < ry1; y++, row -= cw) {
+            int64_t lo = clip.x0, hi = clip.x1 - 1;
+            for (auto& e : edges) {
+                // e.c + e.step_x * x >= 0
+                if (e.step_x > 0) lo = std::max(lo, -floor_div(e.c, e.step_x));
+                else if (e.step_x < 0) hi = std::min(hi, floor_div(e.c, -e.step_x));
+                else if (e.c < 0) hi = lo - 1;
+                e.c += e.step_y;
+            }
+            if (lo > hi) continue;
+            if (!skip_outline) {
+                blend_fill(mode, row + lo, c, (int) (hi - lo + 1));
+                continue;
+            }
+
+            // each edge of the outline covers one run of the row, the span is filled around them
+            struct Run { int x0, x1; };
+            Run runs[3];
+            int run_count = 0;
+            for (int k = 0; k < 3; k++) {
+                Run& r = runs[run_count];
+                if (line_row_run(ox[k], oy[k], ox[(k + 1) % 3], oy[(k + 1) % 3], true, y, r.x0, r.x1)) run_count++;
+            }
+            std::sort(runs, runs + run_count, [](const Run& a, const Run& b) { return a.x0 < b.x0; });
+            int64_t x = lo;
+            for (int k = 0; k < run_count && x <= hi; k++) {
+                if (runs[k].x0 > x) blend_fill(mode, row + x, c, (int) (std::min<int64_t>(runs[k].x0 - 1, hi) - x + 1));
+                x = std::max<int64_t>(x, (int64_t) runs[k].x1 + 1);
+            }
+            if (x <= hi) blend_fill(mode, row + x, c, (int) (hi - x + 1));
+        }
+    }
+
+    // fills every triangle of the mesh, triangles with an index out of range are skipped
+    void Engine::raster_mesh(const Rect& clip, const glm::ivec2* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, Pixel f, BlendMode mode) {
+        if (!resolve_mode(mode, f)) return;
+
+        for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+            uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a >= vertex_count || b >= vertex_count || c >= vertex_count) continue;
+
+            const glm::ivec2& va = vertices[a];
+            const glm::ivec2& vb = vertices[b];
+            const glm::ivec2& vc = vertices[c];
+
+            // most of a large mesh is outside any one tile
+            if (std::max({ va.x, vb.x, vc.x }) < clip.x0 || std::min({ va.x, vb.x, vc.x }) >= clip.x1) continue;
+            if (std::max({ va.y, vb.y, vc.y }) <= clip.y0 || std::min({ va.y, vb.y, vc.y }) >= clip.y1) continue;
+
+            fill_triangle(clip, va.x, va.y, vb.x, vb.y, vc.x, vc.y, f, mode);
+        }
+    }
+
+    // half width of each row of the ellipse with radii rx and ry that a clip spanning rows [dy0, dy1) from the centre needs
+    // hw[a - lo] is row a, for the rows from lo up to one past the furthest clipped row (the stroke looks at the next row out)
+    // keeping the widest x the outline reaches on each row gives it as runs, and the filled shape as one span per row
+    // only those rows are stored and the walk stops once it is past them, so a huge radius costs the clip, not the radius
+    static int ellipse_half_widths(int rx, int ry, int dy0, int dy1, std::vector<int>& hw) {
+        int lo = dy0 <= 0 && dy1 > 0 ? 0 : std::min(abs(dy0), abs(dy1 - 1));
+        int hi = std::min(std::max(abs(dy0), abs(dy1 - 1)) + 1, ry);
+        hw.assign(hi - lo + 1, 0);
+        if (rx == 0 || ry == 0) {
+            for (auto& w : hw) w = rx;
+            return lo;
+        }
+
+        auto widen = [&](int a, int w) {
+            if (a >= lo && a <= hi) hw[a - lo] = std::max(hw[a - lo], w);
+        };
+
+        // circles: integer midpoint circle, one octant mirrored
+        // x only grows and y only shrinks, so nothing is left to store once x is past hi or y is below lo
+        if (rx == ry) {
+            int x = 0, y = rx, d = 1 - rx;
+            while (x <= y && x <= hi && y >= lo) {
+                widen(y, x);
+                widen(x, y);
+                x++;
+                if (d < 0) {
+                    d += 2 * x + 1;
+                } else {
+                    y--;
+                    d += 2 * (x - y) + 1;
+                }
+            }
+            return lo;
+        }
+
+        // ellipses: integer Bresenham ellipse, one quadrant from (-rx, 0) to (0, ry)
+        // the error terms decide the x and y steps independently, which keeps very flat ellipses whole
+        int64_t a2 = (int64_t) rx * rx, b2 = (int64_t) ry * ry;
+        int64_t x = -rx, y = 0;
+        int64_t err = x * (2 * b2 + x) + b2;
+        do {
+            widen((int) y, (int) -x);
+            int64_t e2 = 2 * err;
+            if (e2 >= (x * 2 + 1) * b2) err += (++x * 2 + 1) * b2;
+            if (e2 <= (y * 2 + 1) * a2) err += (++y * 2 + 1) * a2;
+        } while (x <= 0 && y <= hi);
+        // thin ellipses stop short of the tip, whose rows are one pixel wide (already 0)
+        return lo;
+    }
+
+    // where the stroke starts on row a of an outline with half widths hw from row lo (radius ry)
+    // it runs from just past the next row out to the edge, at least one pixel, and the top and bottom rows are solid
+    static inline int stroke_inner(const std::vector<int>& hw, int lo, int a, int ry) {
+        return a < ry ? std::min(hw[a - lo], hw[a - lo + 1] + 1) : 0;
+    }
+
+    // draws the ellipse at (x, y) with radii rx and ry with stroke s, and fill f if given
+    // every row is clipped once and written as spans, so no pixel is blended twice
+    void Engine::raster_ellipse(const Rect& clip, int x, int y, int rx, int ry, Pixel s, const Pixel* f, BlendMode mode) {
+        BlendMode fill_mode = mode;
+        bool stroke = resolve_mode(mode, s);
+        bool fill = f && resolve_mode(fill_mode, *f);
+        if (!stroke && !fill) return;
+
+        int y0 = std::max(y - ry, clip.y0), y1 = std::min(y + ry + 1, clip.y1);
+        if (y0 >= y1) return;
+
+        // reused between calls, and per thread for the tiled rasteriser
+        static thread_local std::vector<int> hw;
+        int lo = ellipse_half_widths(rx, ry, y0 - y, y1 - y, hw);
+
+        auto span = [&](Pixel* row, int xa, int xb, Pixel c, BlendMode m) {
+            xa = std::max(xa, clip.x0);
+            xb = std::min(xb, clip.x1 - 1);
+            if (xa <= xb) blend_fill(m, row + xa, c, xb - xa + 1);
+        };
+
+        int cw = canvas_sprite->get_width();
+        Pixel* row = canvas_sprite->get_row(y0);
+        for (int yy = y0; yy < y1; yy++, row -= cw) {
+            int a = abs(yy - y);
+            int outer = hw[a - lo];
+            int inner = stroke_inner(hw, lo, a, ry);
+
+            if (stroke) {
+                if (inner == 0) {
+                    span(row, x - outer, x + outer, s, mode);
+                } else {
+                    span(row, x - outer, x - inner, s, mode);
+                    span(row, x + inner, x + outer, s, mode);
+                }
+            }
+            if (fill && inner > 0) span(row, x - inner + 1, x + inner - 1, *f, fill_mode);
+        }
+    }
+
+    // draws the pixels of the circle outline at (x, y) with radius r whose angle is between start and end
+    // rows are clipped like raster_ellipse, only the few outline pixels are tested against the angles
+    void Engine::raster_arc(const Rect& clip, int x, int y, int r, float start, float end, Pixel s, BlendMode mode) {
+        const double two_pi = 6.283185307179586;
+        double sweep = end - start;
+        if (sweep >= two_pi || sweep <= -two_pi) {
+            raster_ellipse(clip, x, y, r, r, s, nullptr, mode);
+            return;
+        }
+        sweep = fmod(sweep, two_pi);
+        if (sweep < 0) sweep += two_pi;
+
+        if (!resolve_mode(mode, s)) return;
+
+        int y0 = std::max(y - r, clip.y0), y1 = std::min(y + r + 1, clip.y1);
+        if (y0 >= y1) return;
+
+        static thread_local std::vector<int> hw;
+        int lo = ellipse_half_widths(r, r, y0 - y, y1 - y, hw);
+
+        // y points down, so increasing angles go clockwise on screen
+        double sx = cos(start), sy = sin(start);
+        double ex = cos(start + sweep), ey = sin(start + sweep);
+        auto inside = [&](int dx, int dy) {
+            bool after_start = sx * dy - sy * dx >= 0;
+            bool before_end = dx * ey - dy * ex >= 0;
+            return sweep <= two_pi / 2 ? after_start && before_end : after_start || before_end;
+        };
+
+        // the mode is switched on once, the rows are compiled per mode
+        dispatch_mode(mode, [&](auto blender) {
+            auto span = [&](Pixel* row, int dy, int xa, int xb) {
+                xa = std::max(xa, clip.x0 - x);
+                xb = std::min(xb, clip.x1 - 1 - x);
+                for (int dx = xa; dx <= xb; dx++) {
+                    if (inside(dx, dy)) row[x + dx] = blender.apply(row[x + dx], s);
+                }
+            };
+
+            int cw = canvas_sprite->get_width();
+            Pixel* row = canvas_sprite->get_row(y0);
+            for (int yy = y0; yy < y1; yy++, row -= cw) {
+                int a = abs(yy - y);
+                int outer = hw[a - lo];
+                int inner = stroke_inner(hw, lo, a, r);
+
+                if (inner == 0) {
+                    span(row, yy - y, -outer, outer);
+                } else {
+                    span(row, yy - y, -outer, -inner);
+                    span(row, yy - y, inner, outer);
+                }
+            }
+        });
+    }
+
+    // draws a sprite at (x, y)
+    void Engine::raster_sprite(const Rect& clip, int x, int y, Sprite* sprite, BlendMode mode) {
+        // clip the sprite against the clip rect
+        int i0 = std::max(0, clip.x0 - x), j0 = std::max(0, clip.y0 - y);
+        int i1 = std::min(sprite->get_width(), clip.x1 - x);
+        int j1 = std::min(sprite->get_height(), clip.y1 - y);
+        if (i0 >= i1) return;
+
+        // blend one sprite row at a time
+        for (int j = j0; j < j1; j++) {
+            blend_span(mode, canvas_sprite->get_row(y + j) + x + i0, sprite->get_row(j) + i0, i1 - i0);
+        }
+    }
+
+    // draws an rle sprite at (x, y), clipped to whole rows and then to the runs inside the clip
+    void Engine::raster_rle_sprite(const Rect& clip, int x, int y, const RleSprite* sprite, BlendMode mode) {
+        int i0 = std::max(0, clip.x0 - x), j0 = std::max(0, clip.y0 - y);
+        int i1 = std::min(sprite->get_width(), clip.x1 - x);
+        int j1 = std::min(sprite->get_height(), clip.y1 - y);
+        if (i0 >= i1) return;
+
+        for (int j = j0; j < j1; j++) {
+            sprite->blit_row(j, i0, i1, canvas_sprite->get_row(y + j) + x + i0, mode);
+        }
+    }
+
+    // narrows [lo, hi] to the x where c + d * x is inside [min, max]
+    static inline void clamp_steps(int64_t c, int64_t d, int64_t min, int64_t max, int64_t& lo, int64_t& hi) {
+        if (d > 0) {
+            lo = std::max(lo, -floor_div(c - min, d));
+            hi = std::min(hi, floor_div(max - c, d));
+        } else if (d < 0) {
+            lo = std::max(lo, -floor_div(max - c, -d));
+            hi = std::min(hi, floor_div(c - min, -d));
+        } else if (c < min || c > max) {
+            hi = lo - 1;
+        }
+    }
+
+    // draws a transformed sprite one canvas row at a time
+    // the sprite coordinates of the pixel centres step by a constant per pixel, so each row is solved in 16.16 fixed point
+    // for the span whose samples land inside the sprite, and only that span is sampled and blended
+    void Engine::raster_sprite_transformed(const Rect& clip, const TransformedSpriteCommand& t, BlendMode mode) {
+        Sprite* sprite = t.sprite;
+        const double one = 65536.0;
+        int64_t max_u = ((int64_t) sprite->get_width() << 16) - 1;
+        int64_t max_v = ((int64_t) sprite->get_height() << 16) - 1;
+
+        // a step over a whole sprite is a scale of 1/32768, nothing would be visible
+        int64_t du = llround(t.u[0] * one), dv = llround(t.v[0] * one);
+        if (std::abs(du) > INT32_MAX / 2 || std::abs(dv) > INT32_MAX / 2) return;
+
+        // samples for one row, per thread for the tiled rasteriser
+        static thread_local std::vector<Pixel> samples;
+
+        int cw = canvas_sprite->get_width();
+        Pixel* row = canvas_sprite->get_row(clip.y0);
+        for (int y = clip.y0; y < clip.y1; y++, row -= cw) {
+            // sprite coordinate of the centre of pixel (0, y)
+            int64_t u0 = llround((t.u[0] * 0.5 + t.u[1] * (y + 0.5) + t.u[2]) * one);
+            int64_t v0 = llround((t.v[0] * 0.5 + t.v[1] * (y + 0.5) + t.v[2]) * one);
+
+            int64_t lo = clip.x0, hi = clip.x1 - 1;
+            clamp_steps(u0, du, 0, max_u, lo, hi);
+            clamp_steps(v0, dv, 0, max_v, lo, hi);
+            if (lo > hi) continue;
+
+            int n = (int) (hi - lo + 1);
+            if ((int) samples.size() < n) samples.resize(n);
+
+            int32_t u = (int32_t) (u0 + du * lo), v = (int32_t) (v0 + dv * lo);
+            if (t.sampling == Sampling::BILINEAR) sample_bilinear(sprite, u, v, (int32_t) du, (int32_t) dv, samples.data(), n);
+            else sample_nearest(sprite, u, v, (int32_t) du, (int32_t) dv, samples.data(), n);
+
+            blend_span(mode, row + lo, samples.data(), n);
+        }
+    }
+
+    // index of the lowest set bit, x must not be 0
+    static inline int lowest_bit(uint32_t x) {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, x);
+        return (int) i;
+#else
+        return __builtin_ctz(x);
+#endif
+    }
+
+    // draws len characters of text at (x, y) with fill c
+    // glyphs are bitmasks, each row's runs of lit pixels are found with bit scans and drawn as scaled spans
+    void Engine::raster_text(const Rect& clip, int x, int y, int scale, const char* text, int len, Pixel c, BlendMode mode) {
+        if (!resolve_mode(mode, c)) return;
+
+        int size = CHAR_SIZE * scale;
         int x_off = 0, y_off = 0;
-        for (auto &ch : text) {
+        for (int k = 0; k < len; k++) {
+            char ch = text[k];
+
             // newline means move to next line
             if (ch == '\n') {
                 y_off++;
@@ -507,44 +2398,101 @@ namespace pix2d {
                 continue;
             }
 
-            // convert index into x,y (charset is 16 x 6 chars)
             int index = ch - ' ';
 
+            int gx = x + x_off * size;
+            int gy = y + y_off * size;
+            x_off++;
+
             // if invalid character, leave an empty space
-            if (index < 0 || index > NUM_CHARS_X * NUM_CHARS_Y) {
-                x_off++;
-                continue;
+            if (index < 0 || index >= NUM_CHARS_X * NUM_CHARS_Y) continue;
+
+            // blank glyphs (spaces) and characters entirely outside the clip rect draw nothing
+            uint64_t mask = glyph_masks[index];
+            if (!mask) continue;
+            if (Rect(gx, gy, gx + size, gy + size).intersect(clip).empty()) continue;
+
+            int j = 0;
+            while (j < CHAR_SIZE) {
+                uint32_t bits = (uint32_t) (mask >> (CHAR_SIZE * j)) & 0xFF;
+
+                // rows repeating this one are drawn with it, as taller spans
+                int rows = 1;
+                while (j + rows < CHAR_SIZE && ((uint32_t) (mask >> (CHAR_SIZE * (j + rows))) & 0xFF) == bits) rows++;
+
+                while (bits) {
+                    int i = lowest_bit(bits);
+                    int run = lowest_bit(~(bits >> i));
+                    fill_rect(clip, gx + i * scale, gy + j * scale, run * scale, rows * scale, c, mode);
+                    bits &= ~(((1u << run) - 1) << i);
+                }
+                j += rows;
             }
+        }
+    }
 
-            int x_ind = index % NUM_CHARS_X;
-            int y_ind = index / NUM_CHARS_X;
-
-            // each char is 8x8 pixels
-            int sx = x_ind * CHAR_SIZE;
-            int sy = y_ind * CHAR_SIZE;
-
-            // write one character
-            for (int i = 0; i < CHAR_SIZE; i++) {
-                for (int j = 0; j < CHAR_SIZE; j++) {
-                    Pixel p = font_sprite->get_pixel(sx + i, sy + j);
-                    if (p.a > 0) {
-                        for (int xx = 0; xx < scale; xx++) {
-                            for (int yy = 0; yy < scale; yy++) {
-                                point(x + x_off * CHAR_SIZE * scale + i * scale + xx, y + y_off * CHAR_SIZE * scale + j * scale + yy, c);
-                            }
-                        }
-                    }
+    // draws the placed glyphs of t, each glyph row is its coverage turned into a span of c and blended with the span kernel
+    void Engine::raster_font_text(const Rect& clip, const FontTextCommand& t, const PlacedGlyph* glyphs, BlendMode mode) {
+        // replacing would punch out each glyph's whole box, coverage is always blended
+        if (mode == BlendMode::REPLACE) mode = BlendMode::ALPHA;
+        Pixel c = t.c;
+        bool premultiplied = mode == BlendMode::PREMULTIPLIED;
+        if (c.a == 0 && !premultiplied) return;
+
+        static thread_local std::vector<Pixel> span;
+        int cw = canvas_sprite->get_width();
+
+        for (uint32_t k = 0; k < t.count; k++) {
+            // glyphs outside the clip rect are skipped without looking them up
+            const PlacedGlyph& p = glyphs[k];
+            int gx = t.x + p.x, gy = t.y + p.y;
+            Rect r = Rect(gx, gy, gx + p.w, gy + p.h).intersect(clip);
+            if (r.empty()) continue;
+
+            const Glyph* g = glyph_atlas.get(t.font, t.size, p.codepoint);
+            int n = r.x1 - r.x0;
+            if ((int) span.size() < n) span.resize(n);
+            const uint8_t* cov = g->coverage.data() + (r.y0 - gy) * g->w + (r.x0 - gx);
+            Pixel* row = canvas_sprite->get_row(r.y0) + r.x0;
+            for (int yy = r.y0; yy < r.y1; yy++, row -= cw, cov += g->w) {
+                if (premultiplied) {
+                    for (int i = 0; i < n; i++) span[i] = Pixel((uint8_t) div255(c.r * cov[i]), (uint8_t) div255(c.g * cov[i]), (uint8_t) div255(c.b * cov[i]), (uint8_t) div255(c.a * cov[i]));
+                } else {
+                    for (int i = 0; i < n; i++) span[i] = Pixel(c.r, c.g, c.b, (uint8_t) div255(c.a * cov[i]));
                 }
+                blend_span(mode, row, span.data(), n);
             }
-            x_off++;
         }
     }
 
-    // clears the screen with fill c
-    void Engine::clear(Pixel c) {
-        int pixels = canvas_sprite->get_width() * canvas_sprite->get_height();
-        Pixel* m = canvas_sprite->get_data();
-        for (int i = 0; i < pixels; i++) m[i] = c;
+    // blends c over (x, y) with an already resolved mode
+    void Engine::plot(const Rect& clip, int x, int y, Pixel c, BlendMode mode) {
+        if (x < clip.x0 || y < clip.y0 || x >= clip.x1 || y >= clip.y1) return;
+
+        Pixel* d = canvas_sprite->get_row(y) + x;
+        *d = blend_pixel(mode, *d, c);
+    }
+
+    // blends c over the rect (x, y) to (x + w - 1, y + h - 1) with an already resolved mode
+    // the rect is clipped once, then written as horizontal spans
+    void Engine::fill_rect(const Rect& clip, int x, int y, int w, int h, Pixel c, BlendMode mode) {
+        Rect r = Rect(x, y, x + w, y + h).intersect(clip);
+        if (r.empty()) return;
+
+        int cw = canvas_sprite->get_width();
+
+        // full width rows are contiguous, so the whole rect is a single span
+        // (rows are stored bottom-up, so it starts at the last row)
+        if (r.x0 == 0 && r.x1 == cw) {
+            blend_fill(mode, canvas_sprite->get_row(r.y1 - 1), c, (r.y1 - r.y0) * cw);
+            return;
+        }
+
+        // otherwise step the row pointer, one row at a time
+        Pixel* row = canvas_sprite->get_row(r.y0) + r.x0;
+        for (int yy = r.y0; yy < r.y1; yy++, row -= cw) {
+            blend_fill(mode, row, c, r.x1 - r.x0);
+        }
     }
 
 
@@ -560,6 +2508,26 @@ namespace pix2d {
         else return Button();
     }
 
+    // input events applied at the start of this frame, oldest first
+    const std::vector<InputEvent>& Engine::get_input_events() {
+        return frame_events;
+    }
+
+    // input injection, takes effect at the start of the next frame
+    // call from the engine thread (create or update), used to script input in headless mode but works with a window too
+    void Engine::inject_key(Key k, bool down) {
+        if (k >= 0 && k < NUM_KEYS) keyboard_new[k] = down;
+    }
+
+    void Engine::inject_mouse_btn(int button, bool down) {
+        if (button >= 0 && button < NUM_MOUSE) mbtn_new[button] = down;
+    }
+
+    void Engine::inject_mouse_pos(double x, double y) {
+        mouseX = x;
+        mouseY = y;
+    }
+
     // get absolute x position of mouse
     double Engine::get_mouseX_abs() {
         return mouseX;
@@ -581,41 +2549,67 @@ namespace pix2d {
     }
 
 
+    // glfw callbacks, called on the main thread by pump_events
+    // they never touch the input state directly, the engine thread applies the events at the start of a frame
     void Engine::window_resize_callback(GLFWwindow* window, int width, int height) {
-        int w, h;
-        engine_instance->screen_width = width;
-        engine_instance->screen_height = height;
-        glfwGetFramebufferSize(window, &w, &h);
-	    glViewport(0, 0, w, h);
+        InputEvent e;
+        e.type = InputType::RESIZE;
+        e.x = width;
+        e.y = height;
+        e.time = glfwGetTime();
+        engine_instance->input_ring.push(e);
+        engine_instance->wake();
     }
 
     void Engine::keyboard_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
-        if (engine_instance->map_kb.count(key) != 0) {
-            // use mp_kb to turn key into the engine's representation
-            int eng_rep = engine_instance->map_kb[key];
-
-            // set the appropriate flag for the engine's representation
-            if (action == GLFW_PRESS) {
-                engine_instance->keyboard_new[eng_rep] = true;
-            } else if (action == GLFW_RELEASE) {
-                engine_instance->keyboard_new[eng_rep] = false;
-            }
+        // key repeats don't change any state
+        if (action != GLFW_PRESS && action != GLFW_RELEASE) return;
+
+        auto it = engine_instance->map_kb.find(key);
+        if (it != engine_instance->map_kb.end()) {
+            // use map_kb to turn key into the engine's representation
+            InputEvent e;
+            e.type = InputType::KEY;
+            e.code = it->second;
+            e.down = action == GLFW_PRESS;
+            e.time = glfwGetTime();
+            engine_instance->input_ring.push(e);
+            engine_instance->wake();
         }
     }
 
     void Engine::mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
-        if (button >= 0 && button < NUM_MOUSE) {
-            if (action == GLFW_PRESS) {
-                engine_instance->mbtn_new[button] = true;
-            } else if (action == GLFW_RELEASE) {
-                engine_instance->mbtn_new[button] = false;
-            }
+        if (button >= 0 && button < 3 && action == GLFW_PRESS && engine_instance->profiler_overlay) {
+            std::lock_guard<std::mutex> lock(engine_instance->window_mutex);
+            engine_instance->overlay_clicks[button] = true;
+        }
+        if (button >= 0 && button < NUM_MOUSE && (action == GLFW_PRESS || action == GLFW_RELEASE)) {
+            InputEvent e;
+            e.type = InputType::MOUSE_BUTTON;
+            e.code = button;
+            e.down = action == GLFW_PRESS;
+            e.time = glfwGetTime();
+            engine_instance->input_ring.push(e);
+            engine_instance->wake();
         }
     }
 
+    void Engine::window_focus_callback(GLFWwindow* window, int focused) {
+        engine_instance->window_focused = focused == GLFW_TRUE;
+    }
+
+    void Engine::window_iconify_callback(GLFWwindow* window, int iconified) {
+        engine_instance->window_iconified = iconified == GLFW_TRUE;
+    }
+
     void Engine::mouse_pos_callback(GLFWwindow* window, double x, double y) {
-        engine_instance->mouseX = x;
-        engine_instance->mouseY = y;
+        InputEvent e;
+        e.type = InputType::MOUSE_MOVE;
+        e.x = x;
+        e.y = y;
+        e.time = glfwGetTime();
+        // held back by the ring and coalesced with the moves after it, pump_events wakes the engine once it goes in
+        engine_instance->input_ring.push(e);
     }
 
     Engine* Engine::engine_instance = nullptr;
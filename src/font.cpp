@@ -0,0 +1,301 @@
+// imgui compiles its own static copy of stb_truetype, this one is private to pix2d too
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+
+#include "font.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <imstb_truetype.h>
+
+#include "trace.h"
+
+namespace pix2d {
+    // decodes the utf-8 character starting at p and moves p past it
+    uint32_t decode_utf8(const char*& p, const char* end) {
+        const uint32_t invalid = 0xFFFD;
+        uint8_t b = (uint8_t) *p++;
+        if (b < 0x80) return b;
+
+        // length and payload bits of the lead byte, continuation bytes and overlong forms are invalid
+        int extra;
+        uint32_t c, min;
+        if ((b & 0xE0) == 0xC0) { extra = 1; c = b & 0x1F; min = 0x80; }
+        else if ((b & 0xF0) == 0xE0) { extra = 2; c = b & 0x0F; min = 0x800; }
+        else if ((b & 0xF8) == 0xF0) { extra = 3; c = b & 0x07; min = 0x10000; }
+        else return invalid;
+
+        if (end - p < extra) return invalid;
+        for (int i = 0; i < extra; i++) {
+            uint8_t cb = (uint8_t) p[i];
+            if ((cb & 0xC0) != 0x80) return invalid;
+            c = (c << 6) | (cb & 0x3F);
+        }
+        if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return invalid;
+        p += extra;
+        return c;
+    }
+
+
+    // FONT
+    // load the .ttf file at path
+    Font::Font(const std::string& path) : info{new stbtt_fontinfo()} {
+        PIX2D_TRACE_ZONE("font load");
+        static std::atomic<uint32_t> next_id{1};
+        id = next_id++;
+
+        std::ifstream file(path, std::ios::binary);
+        if (file) data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        int offset = data.empty() ? -1 : stbtt_GetFontOffsetForIndex(data.data(), 0);
+        if (offset < 0 || !stbtt_InitFont(info.get(), data.data(), offset)) {
+            std::cout << "Failed to read font: " << path << std::endl;
+            data.clear();
+            return;
+        }
+
+        stbtt_GetFontVMetrics(info.get(), &ascent, &descent, &line_gap);
+        int x_min, x_max;
+        stbtt_GetFontBoundingBox(info.get(), &x_min, &y_min, &x_max, &y_max);
+        has_kerning = info->kern || info->gpos;
+    }
+
+    Font::~Font() {}
+
+    bool Font::is_loaded() const {
+        return !data.empty();
+    }
+
+    uint32_t Font::get_id() const {
+        return id;
+    }
+
+    // font units to pixels at size
+    float Font::get_scale(int size) const {
+        return stbtt_ScaleForPixelHeight(info.get(), (float) size);
+    }
+
+    // distance from the top of a line to its baseline
+    int Font::get_ascent(int size) const {
+        return (int) ceilf(ascent * get_scale(size));
+    }
+
+    // distance between the baselines of two lines
+    int Font::get_line_height(int size) const {
+        return (int) ceilf((ascent - descent + line_gap) * get_scale(size));
+    }
+
+    // rows any glyph can cover, relative to the baseline, rounded the way glyph boxes are
+    void Font::get_vertical_bounds(int size, int& top, int& bottom) const {
+        float scale = get_scale(size);
+        top = (int) floorf(-y_max * scale);
+        bottom = (int) ceilf(-y_min * scale);
+    }
+
+    bool Font::get_has_kerning() const {
+        return has_kerning;
+    }
+
+    // pen adjustment between two glyph indices, in font units
+    int Font::get_kerning(int index1, int index2) const {
+        if (!has_kerning) return 0;
+        return stbtt_GetGlyphKernAdvance(info.get(), index1, index2);
+    }
+
+    // rasterises codepoint at size into glyph
+    void Font::rasterise(int size, uint32_t codepoint, Glyph& glyph) const {
+        float scale = get_scale(size);
+        glyph.index = stbtt_FindGlyphIndex(info.get(), (int) codepoint);
+
+        int advance, bearing;
+        stbtt_GetGlyphHMetrics(info.get(), glyph.index, &advance, &bearing);
+        glyph.advance = advance * scale;
+
+        int x0, y0, x1, y1;
+        stbtt_GetGlyphBitmapBox(info.get(), glyph.index, scale, scale, &x0, &y0, &x1, &y1);
+        glyph.x0 = x0; glyph.y0 = y0;
+        glyph.w = std::max(x1 - x0, 0); glyph.h = std::max(y1 - y0, 0);
+        glyph.coverage.assign((size_t) glyph.w * glyph.h, 0);
+        if (glyph.w && glyph.h) stbtt_MakeGlyphBitmap(info.get(), glyph.coverage.data(), glyph.w, glyph.h, glyph.w, scale, scale, glyph.index);
+    }
+
+
+    // GLYPH ATLAS
+    // keep roughly budget bytes of coverage
+    GlyphAtlas::GlyphAtlas(size_t budget) : budget{budget} {}
+
+    // the glyph of codepoint in font at size, rasterised if it is not in the atlas
+    const Glyph* GlyphAtlas::get(const Font* font, int size, uint32_t codepoint) {
+        Key key = { font->get_id(), size, codepoint };
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = glyphs.find(key);
+        if (it != glyphs.end()) {
+            // move to the front of the lru list
+            if (it->second != lru.begin()) lru.splice(lru.begin(), lru, it->second);
+            return &it->second->glyph;
+        }
+
+        PIX2D_TRACE_ZONE("glyph rasterise");
+        lru.emplace_front();
+        lru.front().key = key;
+        font->rasterise(size, codepoint, lru.front().glyph);
+        bytes += sizeof(Entry) + lru.front().glyph.coverage.size();
+        glyphs[key] = lru.begin();
+        return &lru.front().glyph;
+    }
+
+    // evicts least recently used glyphs until the atlas fits its budget
+    void GlyphAtlas::trim() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (bytes > budget && !lru.empty()) {
+            Entry& e = lru.back();
+            bytes -= sizeof(Entry) + e.glyph.coverage.size();
+            glyphs.erase(e.key);
+            lru.pop_back();
+        }
+        // pairs take no space worth tracking, they only go when there are a lot of them
+        if (kerning.size() > 65536) kerning.clear();
+    }
+
+    // pen adjustment between two glyph indices of font, in font units
+    int GlyphAtlas::get_kerning(const Font* font, int index1, int index2) {
+        // glyph indices are 16 bits in a TrueType font
+        uint64_t key = ((uint64_t) font->get_id() << 32) | ((uint64_t) (index1 & 0xFFFF) << 16) | (uint64_t) (index2 & 0xFFFF);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = kerning.find(key);
+        if (it != kerning.end()) return it->second;
+        int k = font->get_kerning(index1, index2);
+        kerning[key] = k;
+        return k;
+    }
+
+    // size of the cached coverage in bytes, and number of glyphs
+    size_t GlyphAtlas::get_bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes;
+    }
+
+    size_t GlyphAtlas::get_count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lru.size();
+    }
+
+    // breaks the len bytes of text into lines at most width wide and places their glyphs
+    std::shared_ptr<const TextLayout> GlyphAtlas::layout(const Font* font, int size, const char* text, int len, int width, bool wrap, TextAlign align) {
+        if (!wrap) width = std::max(width, 0);
+
+        // FNV-1a over everything the layout depends on
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](uint32_t v) { for (int i = 0; i < 4; i++) { h ^= (uint8_t) (v >> (8 * i)); h *= 1099511628211ull; } };
+        uint32_t id = font->get_id();
+        mix(id); mix((uint32_t) size); mix((uint32_t) width); mix((uint32_t) wrap); mix((uint32_t) align);
+        for (int i = 0; i < len; i++) { h ^= (uint8_t) text[i]; h *= 1099511628211ull; }
+
+        auto it = layouts.find(h);
+        if (it != layouts.end()) {
+            const LayoutEntry& e = it->second;
+            if (e.font == id && e.size == size && e.width == width && e.wrap == wrap && e.align == align &&
+                e.text.size() == (size_t) len && memcmp(e.text.data(), text, len) == 0) return e.layout;
+        } else if (layouts.size() >= 1024) {
+            // a small cache, dropped wholesale when it fills up
+            layouts.clear();
+        }
+
+        PIX2D_TRACE_ZONE("text layout");
+        // a new layout rather than the entry's old one, which a caller may still hold
+        auto layout = std::make_shared<TextLayout>();
+        TextLayout& l = *layout;
+        l.font = font; l.size = size;
+
+        float scale = font->get_scale(size);
+        bool kerned = font->get_has_kerning();
+        int ascent = font->get_ascent(size);
+        int line_height = font->get_line_height(size);
+        bool wrapping = wrap && width > 0;
+
+        // glyphs of one paragraph, with their unaligned pen positions
+        struct Item { uint32_t codepoint; const Glyph* glyph; float pen; bool space; };
+        static thread_local std::vector<Item> items;
+
+        const char* p = text;
+        const char* end = text + len;
+        while (true) {
+            const char* nl = (const char*) memchr(p, '\n', end - p);
+            const char* para_end = nl ? nl : end;
+
+            items.clear();
+            while (p < para_end) {
+                uint32_t c = decode_utf8(p, para_end);
+                items.push_back({ c, get(font, size, c), 0, c == ' ' || c == '\t' });
+            }
+
+            // greedy breaking, each line takes as many glyphs as fit and goes back to its last space if it overflowed
+            size_t start = 0;
+            do {
+                float pen = 0;
+                size_t i = start, space = start;
+                for (; i < items.size(); i++) {
+                    Item& item = items[i];
+                    if (i > start && kerned) pen += get_kerning(font, items[i - 1].glyph->index, item.glyph->index) * scale;
+                    if (wrapping && i > start && !item.space && pen + item.glyph->advance > width) break;
+                    // remember where the last run of spaces starts
+                    if (item.space && i > start && !items[i - 1].space) space = i;
+                    item.pen = pen;
+                    pen += item.glyph->advance;
+                }
+
+                size_t line_end = i, next = i;
+                if (i < items.size() && space > start) line_end = next = space;
+                while (next < items.size() && items[next].space) next++;
+                while (line_end > start && items[line_end - 1].space) line_end--;
+
+                TextLine line;
+                line.first = (uint32_t) l.glyphs.size();
+                line.baseline = ascent + (int) l.lines.size() * line_height;
+                if (line_end > start) line.width = (int) ceilf(items[line_end - 1].pen + items[line_end - 1].glyph->advance);
+                for (size_t k = start; k < line_end; k++) {
+                    const Glyph* g = items[k].glyph;
+                    if (!g->w || !g->h) continue;
+                    l.glyphs.push_back({ items[k].codepoint, (int) floorf(items[k].pen + 0.5f) + g->x0, line.baseline + g->y0, g->w, g->h });
+                }
+                line.count = (uint32_t) l.glyphs.size() - line.first;
+                l.lines.push_back(line);
+                l.width = std::max(l.width, line.width);
+                start = next;
+            } while (start < items.size());
+
+            if (!nl) break;
+            p = nl + 1;
+        }
+        l.height = (int) l.lines.size() * line_height;
+
+        // align each line inside the width, or inside the widest line when there is no width
+        int box = width > 0 ? width : l.width;
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+        for (auto& line : l.lines) {
+            if (align == TextAlign::CENTER) line.x = (box - line.width) / 2;
+            else if (align == TextAlign::RIGHT) line.x = box - line.width;
+            for (uint32_t k = line.first; k < line.first + line.count; k++) {
+                PlacedGlyph& g = l.glyphs[k];
+                g.x += line.x;
+                x0 = std::min(x0, g.x); y0 = std::min(y0, g.y);
+                x1 = std::max(x1, g.x + g.w); y1 = std::max(y1, g.y + g.h);
+            }
+        }
+        l.ink = l.glyphs.empty() ? Rect() : Rect(x0, y0, x1, y1);
+
+        LayoutEntry& e = layouts[h];
+        e.font = id; e.size = size; e.width = width; e.wrap = wrap; e.align = align;
+        e.text.assign(text, len);
+        e.layout = layout;
+        return layout;
+    }
+}
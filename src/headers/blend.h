@@ -0,0 +1,188 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <cstdint>
+
+#include "sprite.h"
+
+namespace pix2d {
+
+    // how a drawn colour is combined with the canvas
+    enum class BlendMode : uint8_t {
+        REPLACE,        // overwrite the destination
+        ALPHA,          // straight alpha "over" operator (default)
+        ADD,            // add the alpha-weighted source, saturating at 255
+        MULTIPLY,       // multiply the destination by the source, weighted by source alpha
+        PREMULTIPLIED,  // "over" operator for colours already premultiplied by their alpha
+    };
+
+    // exact floor(x / 255) for 0 <= x <= 65025
+    inline uint32_t div255(uint32_t x) {
+        return (x + 1 + (x >> 8)) >> 8;
+    }
+
+    inline uint8_t sat255(uint32_t x) {
+        return (uint8_t) (x > 255 ? 255 : x);
+    }
+
+    // alpha of s composited over d
+    inline uint8_t over_alpha(Pixel d, Pixel s) {
+        return (uint8_t) (s.a + div255(d.a * (255 - s.a)));
+    }
+
+    // blends s over d (straight alpha, "over" operator) in 8-bit fixed point
+    // matches floor() of the exact real-valued result
+    inline Pixel blend_over(Pixel d, Pixel s) {
+        uint32_t ia = 255 - s.a;
+
+        // opaque destination (the usual canvas case), no division needed
+        if (d.a == 255) {
+            return Pixel(
+                (uint8_t) div255(s.r * s.a + d.r * ia),
+                (uint8_t) div255(s.g * s.a + d.g * ia),
+                (uint8_t) div255(s.b * s.a + d.b * ia),
+                255);
+        }
+
+        // weights of source and destination, scaled by 255 * 255
+        uint32_t ws = s.a * 255;
+        uint32_t wd = d.a * ia;
+        uint32_t na = ws + wd;
+        if (na == 0) return Pixel(0, 0, 0, 0);
+
+        return Pixel(
+            (uint8_t) ((s.r * ws + d.r * wd) / na),
+            (uint8_t) ((s.g * ws + d.g * wd) / na),
+            (uint8_t) ((s.b * ws + d.b * wd) / na),
+            (uint8_t) (na / 255));
+    }
+
+    // per-pixel blend equation for each mode
+    template <BlendMode M> struct Blender;
+
+    template <> struct Blender<BlendMode::REPLACE> {
+        static inline Pixel apply(Pixel d, Pixel s) { return s; }
+    };
+
+    template <> struct Blender<BlendMode::ALPHA> {
+        static inline Pixel apply(Pixel d, Pixel s) { return blend_over(d, s); }
+    };
+
+    template <> struct Blender<BlendMode::ADD> {
+        static inline Pixel apply(Pixel d, Pixel s) {
+            return Pixel(
+                sat255(d.r + div255(s.r * s.a)),
+                sat255(d.g + div255(s.g * s.a)),
+                sat255(d.b + div255(s.b * s.a)),
+                over_alpha(d, s));
+        }
+    };
+
+    template <> struct Blender<BlendMode::MULTIPLY> {
+        static inline Pixel apply(Pixel d, Pixel s) {
+            uint32_t ia = 255 - s.a;
+            return Pixel(
+                (uint8_t) div255(d.r * ia + div255(d.r * s.r) * s.a),
+                (uint8_t) div255(d.g * ia + div255(d.g * s.g) * s.a),
+                (uint8_t) div255(d.b * ia + div255(d.b * s.b) * s.a),
+                over_alpha(d, s));
+        }
+    };
+
+    template <> struct Blender<BlendMode::PREMULTIPLIED> {
+        static inline Pixel apply(Pixel d, Pixel s) {
+            uint32_t ia = 255 - s.a;
+            return Pixel(
+                sat255(s.r + div255(d.r * ia)),
+                sat255(s.g + div255(d.g * ia)),
+                sat255(s.b + div255(d.b * ia)),
+                over_alpha(d, s));
+        }
+    };
+
+    // blends the colour s over n consecutive pixels starting at dst
+    template <BlendMode M>
+    inline void blend_fill(Pixel* dst, Pixel s, int n) {
+        for (int i = 0; i < n; i++) dst[i] = Blender<M>::apply(dst[i], s);
+    }
+
+    // blends n pixels from src over n pixels at dst
+    template <BlendMode M>
+    inline void blend_span(Pixel* dst, const Pixel* src, int n) {
+        for (int i = 0; i < n; i++) dst[i] = Blender<M>::apply(dst[i], src[i]);
+    }
+
+    // vectorised kernels (blend.cpp)
+    template <> void blend_fill<BlendMode::REPLACE>(Pixel* dst, Pixel s, int n);
+    template <> void blend_fill<BlendMode::ALPHA>(Pixel* dst, Pixel s, int n);
+    template <> void blend_span<BlendMode::REPLACE>(Pixel* dst, const Pixel* src, int n);
+    template <> void blend_span<BlendMode::ALPHA>(Pixel* dst, const Pixel* src, int n);
+
+    // picks the cheapest mode that gives the same result for a solid colour s
+    // returns false if drawing s would leave the destination unchanged
+    // call once per primitive, not once per pixel
+    inline bool resolve_mode(BlendMode& mode, Pixel s) {
+        switch (mode) {
+            case BlendMode::ALPHA:
+                if (s.a == 0) return false;
+                if (s.a == 255) mode = BlendMode::REPLACE;
+                return true;
+            case BlendMode::PREMULTIPLIED:
+                if (s.a == 0 && s.r == 0 && s.g == 0 && s.b == 0) return false;
+                if (s.a == 255) mode = BlendMode::REPLACE;
+                return true;
+            case BlendMode::ADD:
+            case BlendMode::MULTIPLY:
+                return s.a != 0;
+            default:
+                return true;
+        }
+    }
+
+    // runtime dispatch, the mode is switched on once per call and never inside the span loops
+    inline Pixel blend_pixel(BlendMode mode, Pixel d, Pixel s) {
+        switch (mode) {
+            case BlendMode::REPLACE: return Blender<BlendMode::REPLACE>::apply(d, s);
+            case BlendMode::ADD: return Blender<BlendMode::ADD>::apply(d, s);
+            case BlendMode::MULTIPLY: return Blender<BlendMode::MULTIPLY>::apply(d, s);
+            case BlendMode::PREMULTIPLIED: return Blender<BlendMode::PREMULTIPLIED>::apply(d, s);
+            default: return Blender<BlendMode::ALPHA>::apply(d, s);
+        }
+    }
+
+    // calls f(Blender<M>()) for the mode, so per-pixel loops written inside f are compiled once per mode
+    // and switched on once, for loops that don't fit blend_fill or blend_span
+    template <typename F>
+    inline void dispatch_mode(BlendMode mode, F f) {
+        switch (mode) {
+            case BlendMode::REPLACE: f(Blender<BlendMode::REPLACE>()); break;
+            case BlendMode::ADD: f(Blender<BlendMode::ADD>()); break;
+            case BlendMode::MULTIPLY: f(Blender<BlendMode::MULTIPLY>()); break;
+            case BlendMode::PREMULTIPLIED: f(Blender<BlendMode::PREMULTIPLIED>()); break;
+            default: f(Blender<BlendMode::ALPHA>()); break;
+        }
+    }
+
+    inline void blend_fill(BlendMode mode, Pixel* dst, Pixel s, int n) {
+        switch (mode) {
+            case BlendMode::REPLACE: blend_fill<BlendMode::REPLACE>(dst, s, n); break;
+            case BlendMode::ADD: blend_fill<BlendMode::ADD>(dst, s, n); break;
+            case BlendMode::MULTIPLY: blend_fill<BlendMode::MULTIPLY>(dst, s, n); break;
+            case BlendMode::PREMULTIPLIED: blend_fill<BlendMode::PREMULTIPLIED>(dst, s, n); break;
+            default: blend_fill<BlendMode::ALPHA>(dst, s, n); break;
+        }
+    }
+
+    inline void blend_span(BlendMode mode, Pixel* dst, const Pixel* src, int n) {
+        switch (mode) {
+            case BlendMode::REPLACE: blend_span<BlendMode::REPLACE>(dst, src, n); break;
+            case BlendMode::ADD: blend_span<BlendMode::ADD>(dst, src, n); break;
+            case BlendMode::MULTIPLY: blend_span<BlendMode::MULTIPLY>(dst, src, n); break;
+            case BlendMode::PREMULTIPLIED: blend_span<BlendMode::PREMULTIPLIED>(dst, src, n); break;
+            default: blend_span<BlendMode::ALPHA>(dst, src, n); break;
+        }
+    }
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "sprite.h"
+#include "rle_sprite.h"
+#include "sample.h"
+#include "font.h"
+#include "blend.h"
+
+namespace pix2d {
+
+    // drawing calls that can be recorded and executed later
+    enum class DrawOp : uint8_t {
+        POINT, LINE, RECT, RECT_FILL, FILL, SPRITE, SPRITE_RLE, SPRITE_TRANSFORMED, TEXT, FONT_TEXT, TRIANGLE, TRIANGLE_FILL, MESH, ELLIPSE, ELLIPSE_FILL, ARC, CLEAR
+    };
+
+    // header in front of every command in a CommandBuffer, followed by the op's payload
+    struct CommandHeader {
+        DrawOp op = DrawOp::POINT;
+        BlendMode mode = BlendMode::ALPHA;
+        uint16_t reserved = 0;
+        // size of the whole record (header, payload and trailing data) in bytes
+        uint32_t size = 0;
+        // canvas area the command can touch
+        Rect bounds;
+
+        template <typename T> T* payload() { return reinterpret_cast<T*>(this + 1); }
+        template <typename T> const T* payload() const { return reinterpret_cast<const T*>(this + 1); }
+    };
+
+    // payloads, all plain data, sprites and fonts are pointers to the caller's objects and are read when the command runs
+    struct PointCommand { int x, y; Pixel c; };
+    struct LineCommand { int x1, y1, x2, y2; Pixel c; };
+    // RECT only uses s, FILL (a rect whose stroke and fill match) only uses f
+    struct RectCommand { int x, y, w, h; Pixel s, f; };
+    struct SpriteCommand { int x, y; Sprite* sprite; };
+    struct RleSpriteCommand { int x, y; const RleSprite* sprite; };
+    // canvas to sprite mapping, the sprite coordinate of canvas point (x, y) is (u[0] x + u[1] y + u[2], v[0] x + v[1] y + v[2])
+    struct TransformedSpriteCommand { Sprite* sprite; double u[3], v[3]; Sampling sampling; };
+    // followed by length characters
+    struct TextCommand { int x, y, scale; Pixel c; uint32_t length; };
+    // followed by count PlacedGlyph, placed relative to (x, y)
+    struct FontTextCommand { int x, y, size; const Font* font; Pixel c; uint32_t count; };
+    // TRIANGLE only uses s
+    struct TriangleCommand { int x1, y1, x2, y2, x3, y3; Pixel s, f; };
+    // followed by vertex_count glm::ivec2 vertices, then index_count uint32_t indices (three per triangle)
+    struct MeshCommand { Pixel f; uint32_t vertex_count, index_count; };
+    // circles are ellipses with rx == ry, ELLIPSE only uses s
+    struct EllipseCommand { int x, y, rx, ry; Pixel s, f; };
+    struct ArcCommand { int x, y, r; float start, end; Pixel s; };
+    struct ClearCommand { Pixel c; };
+
+    // a compact stream of drawing commands, stored back to back in one growable arena
+    // clearing keeps the memory, so a buffer reused every frame stops allocating after the first few
+    class CommandBuffer {
+    public: // iteration
+        class iterator {
+        public:
+            iterator(const uint8_t* p) : p{p} {}
+            const CommandHeader& operator*() const { return *reinterpret_cast<const CommandHeader*>(p); }
+            const CommandHeader* operator->() const { return reinterpret_cast<const CommandHeader*>(p); }
+            iterator& operator++() { p += reinterpret_cast<const CommandHeader*>(p)->size; return *this; }
+            bool operator!=(const iterator& o) const { return p != o.p; }
+        private:
+            const uint8_t* p;
+        };
+
+        iterator begin() const { return iterator(data.data()); }
+        iterator end() const { return iterator(data.data() + data.size()); }
+
+    public: // recording
+        // appends a command with payload T and extra trailing bytes, returns the zeroed payload to fill in
+        // the pointer is valid until the next push
+        // a CLEAR hides everything drawn before it, so it empties the buffer first
+        template <typename T>
+        T* push(DrawOp op, BlendMode mode, const Rect& bounds, uint32_t extra=0) {
+            if (op == DrawOp::CLEAR) clear();
+
+            uint32_t size = (uint32_t) ((sizeof(CommandHeader) + sizeof(T) + extra + 7) & ~(size_t) 7);
+            size_t offset = data.size();
+            data.resize(offset + size);
+
+            CommandHeader* h = new (&data[offset]) CommandHeader();
+            h->op = op;
+            h->mode = mode;
+            h->size = size;
+            h->bounds = bounds;
+            count++;
+            return new (h + 1) T();
+        }
+        // appends every command in other
+        void append(const CommandBuffer& other);
+        // empties the buffer, keeping its memory
+        void clear();
+        void swap(CommandBuffer& other);
+
+    public: // queries
+        bool empty() const;
+        // number of commands
+        size_t size() const;
+        // size of the stream in bytes
+        size_t bytes() const;
+        // FNV-1a hash of the stream
+        uint64_t hash() const;
+        // true if both streams are byte for byte the same
+        bool operator==(const CommandBuffer& other) const;
+        bool operator!=(const CommandBuffer& other) const;
+        // the command starting at byte offset
+        const CommandHeader* at(uint32_t offset) const;
+        uint32_t offset_of(const CommandHeader& cmd) const;
+
+    public: // optimisation passes, none of them change what ends up on the canvas
+        // drops commands that cannot touch area
+        void cull(const Rect& area);
+        // joins consecutive FILL commands with the same colour and mode whose union is a rect
+        void merge();
+        // stable sort by op, mode and sprite so similar commands run together
+        // a command only moves past commands it does not overlap
+        void sort();
+
+    private:
+        std::vector<uint8_t> data;
+        size_t count = 0;
+    };
+
+}
+
+#endif
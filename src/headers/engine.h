@@ -5,14 +5,29 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <climits>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <thread>
 #include <string>
 #include <map>
+#include <mutex>
+#include <vector>
 
 #include "sprite.h"
 #include "shader.h"
+#include "blend.h"
+#include "command.h"
+#include "font.h"
+#include "workers.h"
+#include "profiler.h"
+#include "trace.h"
+#include "input.h"
 
 namespace pix2d {
 
@@ -24,6 +39,23 @@ namespace pix2d {
     const int NUM_CHARS_X = 16;
     const int NUM_CHARS_Y = 6;
     const int CHAR_SIZE = 8;
+    static_assert(CHAR_SIZE * CHAR_SIZE == 64, "glyph masks hold one 8x8 glyph per uint64_t");
+    // size of the screen tiles used by the threaded rasteriser and dirty tracking
+    const int TILE_SIZE = 64;
+    // number of pixel buffers the canvas upload cycles through
+    const int PBO_COUNT = 3;
+    // number of recent frame intervals the frame pacing stats are measured over
+    const int PACING_FRAMES = 120;
+    // frame buffers used to hand frames to the render thread in pipelined mode, and the bits of pipeline_ready
+    const int PIPELINE_FRAMES = 3;
+    const int PIPELINE_INDEX = 3;
+    const int PIPELINE_FRESH = 4;
+
+    // where frames go
+    enum class Backend {
+        WINDOW,     // a glfw window with an opengl context (default)
+        HEADLESS,   // no window or gl context, frames only exist in the cpu canvas (for servers and tests)
+    };
 
     struct Button {
         bool pressed = false; // true on the frame when the button is pressed
@@ -31,6 +63,61 @@ namespace pix2d {
         bool held = false; // true on all frames from when button is pressed to when it is released
     };
 
+    // window and mouse state the overlay needs, polled on the main thread since glfw only allows it there
+    struct OverlayInput {
+        int window_width = 0, window_height = 0;
+        int framebuffer_width = 0, framebuffer_height = 0;
+        double mouse_x = -1.0, mouse_y = -1.0;
+        bool mouse_down[3] = { false, false, false };
+        bool focused = false;
+    };
+
+    // canvas texture upload timings for one frame
+    struct UploadStats {
+        double upload_ms = 0.0; // time spent uploading the canvas, including stall_ms
+        double stall_ms = 0.0; // time spent waiting for the gpu to release a pixel buffer
+        int bytes = 0; // bytes uploaded (0 on static frames)
+        bool persistent = false; // true if the pixel buffers are persistently mapped
+    };
+
+    // input latency of one frame, measured in low latency mode
+    struct LatencyStats {
+        double input_to_present_ms = 0.0; // oldest input event used by the frame to the end of its present (0 without input)
+        double wait_ms = 0.0; // time slept before sampling input
+        double work_ms = 0.0; // sampling input to the end of present
+        int events = 0; // input events used by the frame
+    };
+
+    // swap interval modes
+    enum class VSync {
+        DRIVER,     // leave the swap interval to the driver (the default until set_vsync is called)
+        OFF,        // present immediately (tearing)
+        ON,         // wait for vblank
+        ADAPTIVE,   // wait for vblank, but present immediately when a frame is late (falls back to ON if unsupported)
+    };
+
+    // a frame handed to the render thread in pipelined mode, everything in it belongs to whichever thread holds its index
+    struct PipelineFrame {
+        Sprite* sprite = nullptr;
+        // parts of the canvas texture to upload, empty when nothing changed since the last frame the render thread took
+        std::vector<Rect> rects;
+        // the profiler's recent frames when this one was published, for the overlay (empty while it is hidden)
+        std::vector<FrameTimes> profile;
+        // vsync mode to present with
+        VSync vsync = VSync::DRIVER;
+        // filled in by the render thread when it presents the frame, read back once the engine thread gets the buffer again
+        UploadStats upload_stats;
+    };
+
+    // achieved frame pacing over the last PACING_FRAMES frames, in ms
+    struct PacingStats {
+        double target_ms = 0.0; // frame limiter period, 0 when not limiting
+        double mean_ms = 0.0;
+        double jitter_ms = 0.0; // standard deviation of the frame intervals
+        double max_ms = 0.0;
+        int frames = 0;
+    };
+
     // list valid keys (we are going to use a normal US keyboard for now)
     enum Key {
         UNKNOWN,
@@ -50,8 +137,8 @@ namespace pix2d {
         ~Engine();
 
     public: // user engine functions
-        // change the default screen sizes, call before start
-        bool initialise(int canvas_width=640, int canvas_height=480, int screen_width=640, int screen_height=480, const std::string& eng_name="");
+        // change the default screen sizes and backend, call before start
+        bool initialise(int canvas_width=640, int canvas_height=480, int screen_width=640, int screen_height=480, const std::string& eng_name="", Backend backend=Backend::WINDOW);
         // user called: call prepare, start thread, wait for thread to finish
         bool start();
         // user called: used to quit the engine
@@ -59,7 +146,10 @@ namespace pix2d {
         // called when engine initialises
         virtual bool create();
         // called every frame
+        // gets the delta time in ms, or in fixed step mode how far the frame is between two steps (0 to 1)
         virtual bool update(double delta_time);
+        // fixed step mode: called every step_ms of simulated time, before update
+        virtual bool fixed_update(double step_ms);
         // called when engine stops
         virtual bool destroy();
 
@@ -69,6 +159,64 @@ namespace pix2d {
         int get_canvas_width(); int get_canvas_height();
         void set_title(const std::string& title);
         double get_time();
+        bool is_headless();
+        long long get_frame_count();
+        // stop the engine after this many frames, 0 runs until update() returns false
+        void set_frame_limit(int frames);
+        // pass delta_time ms to update() every frame instead of the measured time, <= 0 goes back to measuring
+        void set_fixed_delta_time(double delta_time);
+        // opt-in: record the draw calls made in update() and rasterise them after it returns
+        // sprites, rle sprites and fonts are recorded by pointer, not copied: keep them alive and don't change them
+        // until update() has returned and the frame is rasterised, or the frame draws their later state (or freed memory)
+        void set_deferred(bool enabled);
+        // in deferred mode, skip rasterising a frame whose commands are identical to the previous frame's
+        // only frames that start with clear() or only draw opaque solid colours (or in REPLACE mode) are skipped,
+        // anything else blends over the last frame, so drawing it again would change the canvas
+        // sprites are recorded by pointer, so changing a sprite's pixels alone does not count as a change
+        void set_skip_identical_frames(bool enabled);
+        // opt-in: deferred mode, rasterised in screen tiles on a pool of threads
+        // the same lifetime rules as set_deferred apply to the sprites and fonts drawn
+        // threads <= 0 uses every hardware thread
+        void set_threaded_raster(bool enabled, int threads=0);
+        // canvas texture upload timings for the last frame
+        UploadStats get_upload_stats();
+        // opt-in: time each phase of every frame
+        void set_profiling(bool enabled);
+        // shows or hides the profiler overlay (turns profiling on), does nothing in headless mode
+        void set_profiler_overlay(bool visible);
+        bool get_profiler_overlay();
+        const Profiler& get_profiler();
+        // opt-in: update and rasterise on the engine thread while a render thread uploads and presents the previous frame
+        // buffers 3: the engine thread never waits and the newest frame is presented, 2: every frame is presented
+        // call before start, ignored in headless mode, low latency mode has no effect while pipelined
+        void set_pipelined(bool enabled, int buffers=3);
+        // opt-in: only run a frame when input arrives, a timer fires or invalidate() is called
+        // timeout_ms > 0 also runs a frame when nothing happened for that long
+        void set_idle_mode(bool enabled, double timeout_ms=0.0);
+        // asks for a new frame in idle mode, safe from any thread
+        void invalidate();
+        // asks for a new frame in ms (for animations in idle mode), an earlier request wins
+        void invalidate_in(double ms);
+        // frame limiter target, 0 doesn't limit (the default)
+        void set_target_fps(double fps);
+        // frame rates used instead of the target while the window is unfocused or iconified, 0 keeps the target
+        void set_background_fps(double unfocused, double iconified);
+        // vsync mode, applied at the start of the next frame (the driver decides until this is called)
+        void set_vsync(VSync mode);
+        // DRIVER until set_vsync is called, ON after an ADAPTIVE request the driver doesn't support
+        VSync get_vsync();
+        // achieved frame intervals over the last PACING_FRAMES frames
+        PacingStats get_pacing_stats();
+        // opt-in: call fixed_update every step_ms of elapsed time, update then gets the interpolation factor instead of delta time
+        // at most max_steps steps run per frame, the rest are skipped so a slow frame can't snowball
+        void set_fixed_timestep(bool enabled, double step_ms=1000.0 / 60.0, int max_steps=5);
+        // steps skipped because a frame ran past max_steps, since the engine started
+        long long get_skipped_steps();
+        // opt-in: sleep until just before the next vblank, then sample input, update and present
+        // margin_ms is the extra room left for a frame that takes longer than usual
+        void set_low_latency(bool enabled, double margin_ms=2.0);
+        // input to present latency of the last frame, only measured in low latency mode
+        LatencyStats get_latency_stats();
 
 
     private: // engine workings
@@ -79,6 +227,49 @@ namespace pix2d {
         // clean up
         bool clean_up();
 
+        // creates the window, on the main thread
+        bool create_window();
+        // main thread loop: waits for window events and applies window changes until the engine stops
+        void pump_events();
+        // reads the window and mouse state the overlay needs into overlay_input (main thread)
+        void poll_overlay_input();
+        // asks the main thread to resize the window
+        void request_window_size(int width, int height);
+        // applies the input events received since the last frame
+        void drain_input();
+
+        // sleeps until clock_ms() reaches t
+        void wait_until(double t);
+        // fixed step mode, runs the fixed_update steps due this frame
+        bool run_fixed_steps(double delta_time);
+        // pipelined rendering
+        void start_render_thread();
+        void stop_render_thread();
+        void publish_frame();
+        void render_loop();
+        // idle mode: blocks until there is a reason to draw a frame
+        void wait_for_work();
+        // wakes the engine thread if it is idle
+        void wake();
+        // frame limiter, waits until the next frame is due
+        void pace_frame();
+        // sets the swap interval for mode
+        void apply_vsync(VSync mode);
+        // low latency loop
+        void wait_for_deadline();
+        void measure_latency(double sample_time);
+
+        // milliseconds since prepare(), usable without glfw
+        double clock_ms();
+
+        // frame profiling, all do nothing unless profiling is on
+        void profile_begin_frame();
+        void profile_phase(Phase phase);
+        void profile_end_frame();
+        // draws the profiler overlay with imgui, from the profile of frame when there is one
+        void draw_overlay(const PipelineFrame* frame);
+        void destroy_overlay();
+
         // thread-specific preparation
         bool thread_prepare();
         // thread calls this, checks for input, user update, draw graphics
@@ -89,8 +280,23 @@ namespace pix2d {
         // compiles and loads the default font
         bool construct_font();
 
-        // draw canvas to screen
-        bool draw_canvas();        
+        // draw canvas (or a whole pipelined frame) to screen
+        bool draw_canvas(const PipelineFrame* frame=nullptr);
+        // draws, draws the overlay and swaps
+        bool present(PipelineFrame* frame, bool profile);
+        // uploads the dirty tiles of the canvas to the canvas texture
+        void upload_dirty();
+        // turns a mask of canvas tiles into rects, one per horizontal run (or the whole canvas when most are set)
+        void tile_rects(const std::vector<uint8_t>& tiles, std::vector<Rect>& rects);
+        // uploads upload_rects of a canvas-sized image to the canvas texture
+        void upload(const uint8_t* data);
+        // creates the ring of pixel buffers the canvas is streamed through
+        void construct_pbos();
+        // binds the next pixel buffer, waiting on its fence, and returns where to write (nullptr on failure)
+        uint8_t* begin_pbo();
+        void unmap_pbo();
+        // fences the bound pixel buffer and moves on to the next
+        void end_pbo();
 
     public: // drawing functions
         // draws a point at (x, y)
@@ -100,18 +306,102 @@ namespace pix2d {
         // draws a circle at (x1, y1) with radius r with stroke s, and fill f
         void circle(int x1, int y1, int r, Pixel s);
         void circle(int x1, int y1, int r, Pixel s, Pixel f);
+        // draws an ellipse at (x1, y1) with radii rx and ry with stroke s, and fill f
+        void ellipse(int x1, int y1, int rx, int ry, Pixel s);
+        void ellipse(int x1, int y1, int rx, int ry, Pixel s, Pixel f);
+        // draws the part of the circle at (x1, y1) with radius r from angle start to end (radians, clockwise from +x)
+        void arc(int x1, int y1, int r, float start, float end, Pixel s);
         // draws a rect at (x1, y1) to (x1 + w, y1 + h) with stroke s and fill f
         void rect(int x1, int y1, int w, int h, Pixel s);
         void rect(int x1, int y1, int w, int h, Pixel s, Pixel f);
         // draws a triangle using points (x1, y1), (x2, y2), (x3, y3) with stroke s and fill f
+        // the stroke and fill never share a pixel
         void triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s);
         void triangle(int x1, int y1, int x2, int y2, int x3, int y3, Pixel s, Pixel f);
+        // fills a mesh of triangles with f, indices holds three vertex indices per triangle
+        // edges shared by two triangles are only drawn once, so translucent meshes have no seams
+        void triangles(const std::vector<glm::ivec2>& vertices, const std::vector<uint32_t>& indices, Pixel f);
         // draws a sprite at (x, y)
         void draw_sprite(int x, int y, Sprite* sprite);
+        void draw_sprite(int x, int y, const RleSprite* sprite);
+        // draws a sprite through transform, which maps sprite coordinates ((0, 0) is its top left corner) to the canvas
+        // only the affine part (the top two rows) is used, so translate, rotate, scale and shear
+        void draw_sprite_transformed(Sprite* sprite, const glm::mat3& transform, Sampling sampling=Sampling::NEAREST);
         // draws text at (x, y) with fill c
         void text(int x, int y, int scale, const std::string& text, Pixel c);
+        // draws utf-8 text with font at pixel height size, (x, y) is the top left of the first line
+        // glyphs are antialiased, rasterised the first time they are used and kept in glyph_atlas
+        void text(int x, int y, Font* font, int size, const std::string& text, Pixel c);
+        // draws a layout made by layout_text with its top left corner at (x, y)
+        void text(int x, int y, const TextLayout& layout, Pixel c);
+        // lays out text inside rect (see layout_text) and draws it there, clipped to rect
+        void text(const Rect& rect, Font* font, int size, const std::string& text, Pixel c, bool wrap=true, TextAlign align=TextAlign::LEFT);
+        // width of the widest line and height of all the lines of text, as text() would draw it
+        glm::ivec2 measure_text(int scale, const std::string& text);
+        glm::ivec2 measure_text(Font* font, int size, const std::string& text, int wrap_width=0);
+        // breaks text into lines at most width wide, at spaces if wrap is set, and aligns each line inside width
+        // layouts are cached, so laying out the same label every frame only costs a hash lookup
+        // the layout is shared with the cache and stays valid for as long as it is held
+        std::shared_ptr<const TextLayout> layout_text(Font* font, int size, const std::string& text, int width, bool wrap=true, TextAlign align=TextAlign::LEFT);
         // clears the screen with fill c
         void clear(Pixel c);
+        // sets the blend mode used by all following drawing calls (ALPHA by default)
+        void set_blend_mode(BlendMode mode);
+        BlendMode get_blend_mode();
+        // limits all following drawing calls to the rect (x, y) to (x + w - 1, y + h - 1), inside any clip already pushed
+        void push_clip(int x, int y, int w, int h);
+        // goes back to the clip before the last push_clip
+        void pop_clip();
+        // marks part of the canvas as changed, only needed after writing to canvas_sprite directly
+        void mark_dirty(int x, int y, int w, int h);
+        // records all following drawing calls into buffer instead of drawing them, nullptr goes back to drawing
+        void record(CommandBuffer* buffer);
+        // draws every command in buffer (any number of times), or appends them to the buffer being recorded into
+        void replay(const CommandBuffer& buffer);
+
+    private: // drawing internals
+        // the buffer drawing calls are recorded into, nullptr when drawing immediately
+        CommandBuffer* recording_target();
+        // starts a command for op with the current draw state, returns its payload to fill in
+        // returns nullptr if the command is entirely outside the clip
+        template <typename T> T* begin_command(DrawOp op, const Rect& bounds, uint32_t extra=0);
+        template <typename T> T* begin_command(DrawOp op, BlendMode mode, const Rect& bounds, uint32_t extra=0);
+        // draws the command just started, unless it is being recorded
+        void end_command();
+        // draws cmd, touching only pixels inside area and its bounds
+        void execute(const CommandHeader& cmd, const Rect& area);
+        // rasterises the commands recorded during update()
+        void flush_commands();
+        // bins the commands into screen tiles and rasterises them on the worker pool
+        void raster_tiled(const CommandBuffer& buffer);
+        // marks the tiles overlapping r as needing an upload
+        void mark_dirty(const Rect& r);
+        // the whole canvas as a rect
+        Rect canvas_rect();
+
+        // rasterisers for each command, all clipped to clip
+        void raster_point(const Rect& clip, int x, int y, Pixel p, BlendMode mode);
+        // skip_last leaves out (x2, y2), so joined lines don't draw their shared ends twice
+        void raster_line(const Rect& clip, int x1, int y1, int x2, int y2, Pixel p, BlendMode mode, bool skip_last=false);
+        void raster_rect(const Rect& clip, int x1, int y1, int w, int h, Pixel s, BlendMode mode);
+        void raster_sprite(const Rect& clip, int x, int y, Sprite* sprite, BlendMode mode);
+        void raster_rle_sprite(const Rect& clip, int x, int y, const RleSprite* sprite, BlendMode mode);
+        void raster_sprite_transformed(const Rect& clip, const TransformedSpriteCommand& t, BlendMode mode);
+        void raster_text(const Rect& clip, int x, int y, int scale, const char* text, int len, Pixel c, BlendMode mode);
+        void raster_font_text(const Rect& clip, const FontTextCommand& t, const PlacedGlyph* glyphs, BlendMode mode);
+        void raster_triangle(const Rect& clip, int x1, int y1, int x2, int y2, int x3, int y3, Pixel s, BlendMode mode);
+        // fills with the top-left rule, emitting one span per row (around the outline's pixels with skip_outline)
+        void fill_triangle(const Rect& clip, int x1, int y1, int x2, int y2, int x3, int y3, Pixel c, BlendMode mode, bool skip_outline=false);
+        void raster_mesh(const Rect& clip, const glm::ivec2* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count, Pixel f, BlendMode mode);
+        // fill is optional, the stroke and fill never share a pixel
+        void raster_ellipse(const Rect& clip, int x, int y, int rx, int ry, Pixel s, const Pixel* f, BlendMode mode);
+        void raster_arc(const Rect& clip, int x, int y, int r, float start, float end, Pixel s, BlendMode mode);
+
+        // blends c over (x, y) with a mode already passed through resolve_mode
+        // the rasterisers clip analytically, so this is only used for single points
+        void plot(const Rect& clip, int x, int y, Pixel c, BlendMode mode);
+        // blends c over the rect (x, y) to (x + w - 1, y + h - 1), clipped once up front
+        void fill_rect(const Rect& clip, int x, int y, int w, int h, Pixel c, BlendMode mode);
 
     public: // callback and input functions
         Button get_key(Key k);
@@ -120,30 +410,153 @@ namespace pix2d {
         double get_mouseY_abs();
         double get_mouseX_rel();
         double get_mouseY_rel();
+        // input events applied at the start of this frame, oldest first
+        const std::vector<InputEvent>& get_input_events();
+        // input injection, takes effect at the start of the next frame, call from create or update
+        void inject_key(Key k, bool down);
+        void inject_mouse_btn(int button, bool down);
+        void inject_mouse_pos(double x, double y);
 
-        // for resizing
+        // glfw callbacks (main thread), they only push into input_ring
         static void window_resize_callback(GLFWwindow* window, int width, int height);
         static void keyboard_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
         static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
         static void mouse_pos_callback(GLFWwindow* window, double x, double y);
+        static void window_focus_callback(GLFWwindow* window, int focused);
+        static void window_iconify_callback(GLFWwindow* window, int iconified);
         
     public: // additional variables
         int canvas_width = 640, canvas_height = 480;
         int screen_width = 640, screen_height = 480;
         std::string engine_name = "Pixel Engine";
 
+        // current draw state
+        BlendMode blend_mode = BlendMode::ALPHA;
+        // clip rects, each already intersected with the one below it
+        std::vector<Rect> clip_stack;
+
+        // recorded drawing
+        bool deferred = false;
+        bool skip_identical_frames = false;
+        bool recording_frame = false;
+        bool last_frame_valid = false;
+        CommandBuffer frame_commands, last_frame_commands, immediate_commands;
+        CommandBuffer* user_commands = nullptr;
+
+        // canvas tiles (TILE_SIZE squared) changed since the last upload
+        std::vector<uint8_t> dirty_tiles;
+        int dirty_tiles_x = 0, dirty_tiles_y = 0;
+        int dirty_count = 0;
+
+        // canvas upload, streamed through a ring of pixel buffers
+        unsigned int canvas_pbo[PBO_COUNT] = { 0 };
+        void* canvas_pbo_ptr[PBO_COUNT] = { 0 };
+        GLsync canvas_pbo_fence[PBO_COUNT] = { 0 };
+        int pbo_index = 0;
+        bool pbo_persistent = false;
+        std::vector<Rect> upload_rects;
+        // filled in by the thread that presents, get_upload_stats returns the last presented frame's
+        UploadStats upload_stats, presented_upload_stats;
+
+        // profiler
+        bool profiling = false;
+        std::atomic<bool> profiler_overlay { false };
+        bool imgui_ready = false;
+        // time the overlay was last drawn, for imgui's delta time
+        double overlay_time = 0.0;
+        double frame_start = 0.0, phase_start = 0.0;
+        FrameTimes frame_times;
+        Profiler profiler;
+
+        // pipelined rendering
+        bool pipelined = false;
+        int pipeline_depth = 3;
+        PipelineFrame pipeline_frames[PIPELINE_FRAMES];
+        // engine thread only: the tiles each buffer is missing from the canvas,
+        // and the tiles changed since the last frame the render thread took (the texture doesn't have them yet)
+        std::vector<uint8_t> pipeline_stale[PIPELINE_FRAMES];
+        std::vector<uint8_t> pipeline_pending;
+        // engine thread only: the rects copied into the buffer being published (upload_rects belongs to the render thread)
+        std::vector<Rect> pipeline_copy;
+        // index of the newest published frame, with PIPELINE_FRESH set until the render thread takes it
+        std::atomic<int> pipeline_ready { 0 };
+        int pipeline_write = 1; // engine thread's buffer
+        int pipeline_read = 2; // render thread's buffer
+        std::atomic<bool> render_running { false };
+        std::thread render_thread;
+        // only used to sleep while there is nothing to do, frames are handed over through pipeline_ready
+        std::mutex pipeline_mutex;
+        std::condition_variable pipeline_cv;
+
+        // viewport size, set by resize events and applied by the thread that presents
+        std::atomic<bool> viewport_changed { false };
+        std::atomic<int> viewport_width { 0 }, viewport_height { 0 };
+
+        // idle mode
+        std::atomic<bool> idle_mode { false };
+        double idle_timeout = 0.0;
+        std::mutex idle_mutex;
+        std::condition_variable idle_cv;
+        bool invalidated = true;
+        double invalidate_time = 0.0;
+
+        // frame pacing
+        double target_fps = 0.0, unfocused_fps = 0.0, iconified_fps = 10.0;
+        VSync vsync_mode = VSync::DRIVER;
+        // presenting thread only: the mode the swap interval was last set for
+        VSync applied_vsync = VSync::DRIVER;
+        std::atomic<bool> adaptive_unsupported { false };
+        std::atomic<bool> window_focused { true }, window_iconified { false };
+        double next_frame_time = 0.0, last_frame_end = 0.0, pacing_target_ms = 0.0;
+        double frame_intervals[PACING_FRAMES] = { 0 };
+        long long interval_index = 0;
+
+        // fixed step mode
+        bool fixed_step = false;
+        double fixed_step_ms = 1000.0 / 60.0;
+        int max_fixed_steps = 5;
+        double step_accumulator = 0.0;
+        long long skipped_steps = 0;
+
+        // low latency loop
+        bool low_latency = false;
+        double latency_margin = 2.0;
+        double refresh_rate = 60.0;
+        double last_present = 0.0, frame_work_ms = 0.0;
+        LatencyStats latency_stats;
+
+        // threaded rasteriser
+        bool threaded_raster = false;
+        int raster_threads = 0;
+        std::vector<std::vector<uint32_t>> tile_bins;
+        WorkerPool* raster_pool = nullptr;
+
+        Backend backend = Backend::WINDOW;
+        int frame_limit = 0;
+        long long frame_count = 0;
+        double fixed_delta_time = 0.0;
+        double sim_time = 0.0;
+        std::chrono::steady_clock::time_point clock_origin;
+
         double time_1, time_2;
 
         Sprite* font_sprite = nullptr;
+        // bit (8 * row + column) of each glyph is set where the font pixel is lit
+        uint64_t glyph_masks[NUM_CHARS_X * NUM_CHARS_Y] = { 0 };
+        // glyphs of the fonts drawn with text(), trimmed to its budget when text is recorded
+        GlyphAtlas glyph_atlas;
         Sprite* canvas_sprite = nullptr;
 
         GLFWwindow* window = nullptr;
         static std::atomic<bool> is_running;
+        // set when the engine thread returns, the main thread pumps events until then (destroy() can keep the engine running)
+        std::atomic<bool> engine_finished { false };
 
         // graphic buffers and stuff
         unsigned int canvas_texture;
         unsigned int canvas_vbo, canvas_vao, canvas_ebo;
         Shader canvas_shader;
+        UniformHandle<int> canvas_tex_uniform;
 
         // input buttons
         // maintain a static variable that keeps track of the engine instance (so static callbacks can modify instance variables)
@@ -159,6 +572,20 @@ namespace pix2d {
         bool mbtn_new[NUM_MOUSE] = { 0 };
 
         double mouseX = 0, mouseY = 0;
+
+        // filled by the glfw callbacks on the main thread, drained by the engine thread every frame
+        InputRing input_ring;
+        std::vector<InputEvent> frame_events;
+
+        // window changes requested by the engine thread, applied by the main thread
+        std::mutex window_mutex;
+        std::string pending_title;
+        int pending_width = 0, pending_height = 0;
+        bool title_changed = false, size_changed = false;
+        // written by the main thread while the overlay is shown, read by the thread drawing it
+        OverlayInput overlay_input;
+        // mouse presses since the overlay last read its input, so clicks shorter than a frame still register
+        bool overlay_clicks[3] = { false, false, false };
     };
 }
 
@@ -0,0 +1,165 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sprite.h"
+
+struct stbtt_fontinfo;
+
+namespace pix2d {
+
+    // decodes the utf-8 character starting at p and moves p past it
+    // malformed or truncated sequences decode as U+FFFD, one byte at a time
+    uint32_t decode_utf8(const char*& p, const char* end);
+
+    // a rasterised glyph, coverage holds w * h bytes (0 to 255), top row first
+    struct Glyph {
+        // glyph index in the font, used for kerning
+        int index = 0;
+        // top left corner of the coverage relative to the pen position on the baseline
+        int x0 = 0, y0 = 0, w = 0, h = 0;
+        // how far the pen moves after this glyph, in pixels
+        float advance = 0;
+        std::vector<uint8_t> coverage;
+    };
+
+    // a TrueType font loaded at runtime, sizes are pixel heights (ascent to descent)
+    class Font {
+    public: // constructors
+        // load the .ttf file at path
+        Font(const std::string& path);
+        ~Font();
+
+    public: // metrics
+        bool is_loaded() const;
+        // unique to each font ever created, so a font allocated where a deleted one was doesn't share its glyphs
+        uint32_t get_id() const;
+        // font units to pixels at size
+        float get_scale(int size) const;
+        // distance from the top of a line to its baseline
+        int get_ascent(int size) const;
+        // distance between the baselines of two lines
+        int get_line_height(int size) const;
+        // rows any glyph can cover, relative to the baseline (top is negative)
+        void get_vertical_bounds(int size, int& top, int& bottom) const;
+        bool get_has_kerning() const;
+        // pen adjustment between two glyph indices, in font units
+        int get_kerning(int index1, int index2) const;
+        // rasterises codepoint at size into glyph
+        void rasterise(int size, uint32_t codepoint, Glyph& glyph) const;
+
+    private:
+        std::vector<unsigned char> data;
+        std::unique_ptr<stbtt_fontinfo> info;
+        uint32_t id = 0;
+        bool has_kerning = false;
+        // unscaled vertical metrics
+        int ascent = 0, descent = 0, line_gap = 0, y_min = 0, y_max = 0;
+    };
+
+    // where each line of a layout goes inside its width
+    enum class TextAlign : uint8_t {
+        LEFT, CENTER, RIGHT,
+    };
+
+    // a glyph placed by a layout, (x, y) is the top left of its coverage relative to the top left of the layout
+    struct PlacedGlyph {
+        uint32_t codepoint;
+        int x, y, w, h;
+    };
+
+    // a line of a layout, made of glyphs first to first + count - 1 (only glyphs that draw something are placed)
+    struct TextLine {
+        uint32_t first = 0, count = 0;
+        // left edge after alignment, baseline and advance width (trailing spaces not included)
+        int x = 0, baseline = 0, width = 0;
+    };
+
+    // text broken into lines of placed glyphs, ready to draw
+    struct TextLayout {
+        const Font* font = nullptr;
+        int size = 0;
+        // width of the widest line and height of all the lines
+        int width = 0, height = 0;
+        // pixels the glyphs cover, relative to the top left of the layout
+        Rect ink;
+        std::vector<TextLine> lines;
+        std::vector<PlacedGlyph> glyphs;
+    };
+
+    // glyphs of every font and size, rasterised on first use and kept until the least recently used are evicted
+    // everything is drawn on the cpu, so rather than packing one texture the atlas keeps a coverage mask per glyph
+    // get() may be called from the raster threads, the rest only from the thread recording draw calls
+    class GlyphAtlas {
+    public: // constructors
+        // keep roughly budget bytes of coverage
+        GlyphAtlas(size_t budget=4 << 20);
+
+    public: // glyphs
+        // the glyph of codepoint in font at size, rasterised if it is not in the atlas
+        // never evicts, so the pointer stays valid until the next trim()
+        const Glyph* get(const Font* font, int size, uint32_t codepoint);
+        // evicts least recently used glyphs until the atlas fits its budget
+        // must not run while anything is being rasterised
+        void trim();
+        // pen adjustment between two glyph indices of font, in font units
+        // looking kerning up in the font is slow, so every pair is cached
+        int get_kerning(const Font* font, int index1, int index2);
+        // size of the cached coverage in bytes, and number of glyphs
+        size_t get_bytes();
+        size_t get_count();
+
+    public: // layout
+        // breaks the len bytes of text into lines at most width wide and places their glyphs
+        // lines only break at newlines unless wrap is set and width is above 0, then they also break after spaces (or inside words too long for a line)
+        // layouts are cached by (text, font, size, width, wrap, align), so a label laid out every frame is a hash lookup
+        // the cache and the caller share the layout, it stays valid however the cache changes later
+        std::shared_ptr<const TextLayout> layout(const Font* font, int size, const char* text, int len, int width, bool wrap, TextAlign align);
+
+    private:
+        struct Key {
+            uint32_t font;
+            int size;
+            uint32_t codepoint;
+            bool operator==(const Key& o) const { return font == o.font && size == o.size && codepoint == o.codepoint; }
+        };
+        struct KeyHash {
+            size_t operator()(const Key& k) const {
+                return ((size_t) k.font * 2654435761u) ^ ((size_t) k.size << 21) ^ k.codepoint;
+            }
+        };
+        struct Entry {
+            Key key;
+            Glyph glyph;
+        };
+        // cached layouts, keyed by a hash of everything they depend on, which is kept to rule out collisions
+        struct LayoutEntry {
+            uint32_t font;
+            int size, width;
+            bool wrap;
+            TextAlign align;
+            std::string text;
+            std::shared_ptr<const TextLayout> layout;
+        };
+
+        std::mutex mutex;
+        size_t budget, bytes = 0;
+        // most recently used first
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> glyphs;
+        std::unordered_map<uint64_t, LayoutEntry> layouts;
+        // unscaled kerning, keyed by (font id, index1, index2)
+        std::unordered_map<uint64_t, int> kerning;
+    };
+
+}
+
+#endif
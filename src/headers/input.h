@@ -0,0 +1,63 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace pix2d {
+
+    // number of input events that can wait for the engine thread, events past this are dropped
+    const uint32_t INPUT_RING_SIZE = 1024;
+    // slots only key and button events can use, so a flood of moves or resizes never drops a release
+    // (a key or button event is only dropped when at least this many of them are waiting)
+    const uint32_t INPUT_RING_RESERVED = 64;
+
+    enum class InputType : uint8_t {
+        KEY,            // code is a Key
+        MOUSE_BUTTON,   // code is the mouse button
+        MOUSE_MOVE,     // (x, y) is the new cursor position
+        RESIZE,         // (x, y) is the new framebuffer size
+    };
+
+    // one input event, as received by the main thread
+    struct InputEvent {
+        InputType type = InputType::KEY;
+        bool down = false;  // KEY and MOUSE_BUTTON
+        int code = 0;
+        double x = 0.0, y = 0.0;
+        double time = 0.0;  // glfwGetTime() when the event was received, in seconds
+    };
+
+    // lock-free ring of input events with a single producer (the main thread) and a single consumer (the engine thread)
+    // consecutive mouse moves are coalesced by the producer, only the latest position goes in the ring
+    class InputRing {
+    public:
+        // producer: adds e, false if the ring is full
+        // a mouse move is held back until flush() or the next other event, replacing any move held before it
+        bool push(const InputEvent& e);
+        // producer: adds the held back mouse move, true if one was added
+        // kept for a later flush if the ring is too full for moves
+        bool flush();
+        // consumer: the oldest event, nullptr if there is none
+        const InputEvent* front() const;
+        // consumer: removes the oldest event
+        void pop();
+        // events dropped because the ring was full
+        uint64_t get_dropped() const;
+
+    private:
+        InputEvent events[INPUT_RING_SIZE];
+        std::atomic<uint32_t> head { 0 }; // next slot to write, only the producer stores it
+        std::atomic<uint32_t> tail { 0 }; // next slot to read, only the consumer stores it
+        std::atomic<uint64_t> dropped { 0 };
+        // only the producer touches these
+        InputEvent pending_move;
+        bool has_pending_move = false;
+
+        // producer: writes e if it leaves at least reserve slots free
+        bool write(const InputEvent& e, uint32_t reserve);
+    };
+
+}
+
+#endif
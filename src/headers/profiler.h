@@ -0,0 +1,73 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace pix2d {
+
+    // number of recent frames the profiler keeps
+    const int PROFILER_FRAMES = 240;
+
+    // parts of a frame timed by the profiler
+    enum class Phase : uint8_t {
+        WAIT,       // sleeping (low latency mode and the frame limiter)
+        INPUT,      // turning the polled input into button states
+        FIXED,      // fixed_update steps (fixed step mode)
+        UPDATE,     // user update() (includes rasterisation when drawing immediately)
+        RASTER,     // rasterising the recorded commands (deferred and threaded modes)
+        UPLOAD,     // uploading the canvas and drawing it to the screen
+        OVERLAY,    // drawing the profiler overlay itself
+        SWAP,       // glfwSwapBuffers
+        POLL,       // taking the input events the main thread received (start of the frame)
+        FRAME,      // the whole frame
+        COUNT
+    };
+
+    const int PHASE_COUNT = (int) Phase::COUNT;
+
+    // time spent in each phase of one frame, in ms
+    struct FrameTimes {
+        double ms[PHASE_COUNT] = { 0 };
+        int fixed_steps = 0; // fixed_update calls this frame
+        int skipped_steps = 0; // fixed steps dropped because the frame ran out of catch-up budget
+    };
+
+    // percentiles of one phase over the recorded frames, in ms
+    struct PhaseStats {
+        double last = 0.0, mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0;
+    };
+
+    // keeps the times of the last PROFILER_FRAMES frames in a ring
+    // one thread (the engine thread) pushes, any thread can read without locking
+    // a reader that falls a whole ring behind can see a frame that is being overwritten
+    class Profiler {
+    public:
+        // stores a finished frame, overwriting the oldest
+        void push(const FrameTimes& frame);
+        // copies up to max_frames of the most recent frames into out, oldest first, returns how many
+        int get_frames(FrameTimes* out, int max_frames) const;
+        // stats of phase over the recorded frames
+        PhaseStats get_stats(Phase phase) const;
+        // number of frames pushed so far
+        uint64_t get_count() const;
+        // fixed steps skipped over the recorded frames
+        int get_skipped_steps() const;
+        static const char* get_name(Phase phase);
+
+        // the same over n frames copied out with get_frames, for threads that mustn't read the ring while it is pushed to
+        static PhaseStats get_stats(const FrameTimes* frames, int n, Phase phase);
+        static int get_skipped_steps(const FrameTimes* frames, int n);
+
+        // draws the frame-time graphs and percentiles as an imgui window (call between ImGui::NewFrame and ImGui::Render)
+        void draw_overlay() const;
+        static void draw_overlay(const FrameTimes* frames, int n);
+
+    private:
+        FrameTimes frames[PROFILER_FRAMES];
+        std::atomic<uint64_t> count { 0 };
+    };
+
+}
+
+#endif
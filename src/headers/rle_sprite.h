@@ -0,0 +1,59 @@
+#ifndef RLE_SPRITE_H
+#define RLE_SPRITE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sprite.h"
+#include "blend.h"
+
+namespace pix2d {
+
+    // what a run of pixels needs when it is drawn
+    enum class RunKind : uint8_t {
+        TRANSPARENT,    // alpha 0, nothing stored
+        OPAQUE,         // alpha 255, copied in the modes where that is the same as blending
+        TRANSLUCENT,    // blended
+    };
+
+    struct Run {
+        uint16_t length = 0;
+        RunKind kind = RunKind::TRANSPARENT;
+    };
+
+    // a sprite encoded as runs of transparent, opaque and translucent pixels on each row
+    // transparent pixels take no memory, and drawing skips them, copies opaque runs and only blends translucent ones
+    // fully transparent pixels are stored as (0, 0, 0, 0), whatever their colour was
+    class RleSprite {
+    public: // constructors
+        // create an empty sprite
+        RleSprite();
+        // encode a copy of sprite
+        RleSprite(Sprite* sprite);
+        // create a sprite from image
+        RleSprite(const std::string& image);
+
+    public: // sprite data
+        // get width and height
+        int get_width() const;
+        int get_height() const;
+        // size of the encoded runs and pixels in bytes
+        size_t get_bytes() const;
+        // blends columns i0 to i1 - 1 of row y (0 is the top) onto dst, where column i0 goes
+        void blit_row(int y, int i0, int i1, Pixel* dst, BlendMode mode) const;
+
+    private:
+        void encode(Sprite* sprite);
+
+        int width = 0, height = 0;
+        std::vector<Run> runs;
+        // the pixels of the opaque and translucent runs, in order
+        std::vector<Pixel> pixels;
+        // first run and first pixel of each row, plus one past the last row
+        std::vector<uint32_t> row_runs, row_pixels;
+    };
+
+}
+
+#endif
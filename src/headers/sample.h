@@ -0,0 +1,28 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <cstdint>
+
+#include "sprite.h"
+
+namespace pix2d {
+
+    // how a scaled or rotated sprite is sampled
+    enum class Sampling : uint8_t {
+        NEAREST,    // the texel under each pixel centre
+        BILINEAR,   // the 4 nearest texels, weighted by distance (straight alpha, like GL_LINEAR)
+    };
+
+    // largest sprite width or height the 16.16 fixed point samplers can address
+    const int SAMPLE_MAX_SIZE = 32767;
+
+    // fills out with n samples of sprite, the first at texel coordinate (u, v), each next one (du, dv) further on
+    // coordinates are 16.16 fixed point with (0, 0) the top left corner of the sprite
+    // nearest: every sample has to be inside the sprite
+    void sample_nearest(Sprite* sprite, int32_t u, int32_t v, int32_t du, int32_t dv, Pixel* out, int n);
+    // bilinear: samples up to half a texel outside the sprite are fine, the taps are clamped to its edges
+    void sample_bilinear(Sprite* sprite, int32_t u, int32_t v, int32_t du, int32_t dv, Pixel* out, int n);
+
+}
+
+#endif
@@ -4,11 +4,37 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// uploads a value to a uniform location of the program in use
+inline void set_uniform(int location, bool value) { glUniform1i(location, value); }
+inline void set_uniform(int location, int value) { glUniform1i(location, value); }
+inline void set_uniform(int location, float value) { glUniform1f(location, value); }
+inline void set_uniform(int location, const glm::vec2& value) { glUniform2fv(location, 1, &value[0]); }
+inline void set_uniform(int location, const glm::vec3& value) { glUniform3fv(location, 1, &value[0]); }
+inline void set_uniform(int location, const glm::vec4& value) { glUniform4fv(location, 1, &value[0]); }
+inline void set_uniform(int location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+
+// a uniform location looked up once, so hot loops can set it without any name lookup
+// setting an invalid handle (unknown or inactive uniform) does nothing, like glUniform with -1
+template <typename T>
+class UniformHandle {
+public:
+	UniformHandle(int location=-1) : location{location} {}
+
+	void set(const T& value) const { set_uniform(location, value); }
+	bool valid() const { return location >= 0; }
+	int get_location() const { return location; }
+
+private:
+	int location;
+};
+
 class Shader {
 public:
 	unsigned int ID;
@@ -18,6 +44,12 @@ public:
 
 	void use();
 
+	// location of an active uniform from the table read after linking, -1 if there is none
+	// array elements other than [0] are asked for once, then cached in the table
+	int location(const std::string& name) const;
+	template <typename T>
+	UniformHandle<T> uniform(const std::string& name) const { return UniformHandle<T>(location(name)); }
+
 	void set_bool(const std::string& name, bool value) const;
 	void set_int(const std::string& name, int value) const;
 	void set_float(const std::string& name, float value) const;
@@ -28,6 +60,14 @@ public:
 	void set_vector4(const std::string& name, const glm::vec4& value) const;
 	void set_vector4(const std::string& name, float x, float y, float z, float w) const;
 	void set_matrix4(const std::string& name, const glm::mat4& mat) const;
+
+private:
+	// reads every active uniform into the lookup table
+	void read_uniforms();
+
+	// active uniforms sorted by name, arrays are stored under name[0] and their base name
+	// other array elements are added the first time they are looked up
+	mutable std::vector<std::pair<std::string, int>> uniforms;
 };
 
 #endif
\ No newline at end of file
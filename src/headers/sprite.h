@@ -15,6 +15,18 @@ namespace pix2d {
         Pixel(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
     };
 
+    // rect covering x0 <= x < x1 and y0 <= y < y1
+    struct Rect {
+        int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        Rect() {}
+        Rect(int x0, int y0, int x1, int y1) : x0{x0}, y0{y0}, x1{x1}, y1{y1} {}
+
+        bool empty() const { return x0 >= x1 || y0 >= y1; }
+        Rect intersect(const Rect& o) const {
+            return Rect(x0 > o.x0 ? x0 : o.x0, y0 > o.y0 ? y0 : o.y0, x1 < o.x1 ? x1 : o.x1, y1 < o.y1 ? y1 : o.y1);
+        }
+    };
+
     // some constant pixel colours
     static const Pixel
         RED(255, 0, 0), GREEN(0, 255, 0), BLUE(0, 0, 255),
@@ -40,6 +52,8 @@ namespace pix2d {
         Pixel get_pixel(int x, int y);
         // set pixel at (x, y) to p
         void set_pixel(int x, int y, Pixel p);
+        // get a pointer to the start of row y (no bounds checking, (0, 0) is the top left)
+        Pixel* get_row(int y);
         // get a copy of this sprite
         Sprite* duplicate();
         // get the array representing this sprite
@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// chrome://tracing (and Perfetto) export of scoped timing zones
+// compiled out entirely unless PIX2D_ENABLE_TRACE is defined (cmake -DPIX2D_TRACE=ON)
+//
+//  PIX2D_TRACE_BEGIN("trace.json");   // start streaming zones to a file, false if it couldn't (always when compiled out)
+//  { PIX2D_TRACE_ZONE("my zone"); ... }  // times the rest of the scope, the name must be a string literal
+//  PIX2D_TRACE_END();                 // flush everything and close the file
+
+#ifdef PIX2D_ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace pix2d {
+    namespace trace {
+
+        // events each thread can have waiting for the flusher, zones past this are dropped (and counted)
+        const uint32_t THREAD_BUFFER_EVENTS = 1 << 14;
+
+        extern std::atomic<bool> session_active;
+
+        inline bool active() {
+            return session_active.load(std::memory_order_relaxed);
+        }
+
+        inline uint64_t now_ns() {
+            return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // stores a finished zone in the calling thread's buffer, never blocks
+        void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+        // opens path and starts the background flusher, false if a session is running or the file can't be opened
+        bool begin_session(const std::string& path);
+        // stops the flusher, writes the remaining zones and closes the file
+        void end_session();
+        // zones dropped because a thread buffer was full, in the current or last session
+        uint64_t dropped();
+
+        // times its own lifetime
+        class Zone {
+        public:
+            Zone(const char* name) : name{name}, start{active() ? now_ns() : 0} {}
+            ~Zone() { if (start) record(name, start, now_ns()); }
+
+            Zone(const Zone&) = delete;
+            Zone& operator=(const Zone&) = delete;
+
+        private:
+            const char* name;
+            uint64_t start;
+        };
+
+    }
+}
+
+#define PIX2D_TRACE_CONCAT_(a, b) a##b
+#define PIX2D_TRACE_CONCAT(a, b) PIX2D_TRACE_CONCAT_(a, b)
+#define PIX2D_TRACE_ZONE(name) pix2d::trace::Zone PIX2D_TRACE_CONCAT(pix2d_trace_zone_, __LINE__)(name)
+#define PIX2D_TRACE_BEGIN(path) pix2d::trace::begin_session(path)
+#define PIX2D_TRACE_END() pix2d::trace::end_session()
+
+#else
+
+#define PIX2D_TRACE_ZONE(name) ((void) 0)
+#define PIX2D_TRACE_BEGIN(path) ((void) (path), false)
+#define PIX2D_TRACE_END() ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pix2d {
+
+    // a persistent pool of threads for running parallel-for style jobs
+    class WorkerPool {
+    public: // constructors
+        // threads <= 0 uses one thread per hardware thread (the calling thread counts as one)
+        WorkerPool(int threads=0);
+        ~WorkerPool();
+
+    public:
+        // runs job(i) for every 0 <= i < count on the pool and the calling thread, returns when all are done
+        void run(int count, const std::function<void(int)>& job);
+        // number of threads working on a job, including the calling thread
+        int get_size();
+
+    private:
+        // worker thread loop
+        void worker();
+        // takes job indices until there are none left
+        void drain();
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable start_cv, done_cv;
+
+        const std::function<void(int)>* job = nullptr;
+        int job_count = 0;
+        std::atomic<int> next_index { 0 };
+        int active = 0;
+        unsigned long long generation = 0;
+        bool stopping = false;
+    };
+
+}
+
+#endif
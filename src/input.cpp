@@ -0,0 +1,57 @@
+#include "input.h"
+
+namespace pix2d {
+    // producer: adds e, false if the ring is full
+    bool InputRing::push(const InputEvent& e) {
+        if (e.type == InputType::MOUSE_MOVE) {
+            pending_move = e;
+            has_pending_move = true;
+            return true;
+        }
+
+        // keep the order, the move happened before e (a click needs the position it happened at)
+        // moves stay out of the reserved slots too, without room this one waits for a later flush
+        if (has_pending_move && write(pending_move, INPUT_RING_RESERVED)) has_pending_move = false;
+        bool reserved = e.type == InputType::KEY || e.type == InputType::MOUSE_BUTTON;
+        if (!write(e, reserved ? 0 : INPUT_RING_RESERVED)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // producer: adds the held back mouse move, true if one was added
+    bool InputRing::flush() {
+        if (!has_pending_move || !write(pending_move, INPUT_RING_RESERVED)) return false;
+        has_pending_move = false;
+        return true;
+    }
+
+    // producer: writes e if it leaves at least reserve slots free
+    bool InputRing::write(const InputEvent& e, uint32_t reserve) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) + reserve >= INPUT_RING_SIZE) return false;
+        events[h % INPUT_RING_SIZE] = e;
+        // publish the event after it has been written
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: the oldest event, nullptr if there is none
+    const InputEvent* InputRing::front() const {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return nullptr;
+        return &events[t % INPUT_RING_SIZE];
+    }
+
+    // consumer: removes the oldest event
+    void InputRing::pop() {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t != head.load(std::memory_order_acquire)) tail.store(t + 1, std::memory_order_release);
+    }
+
+    // events dropped because the ring was full
+    uint64_t InputRing::get_dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+}
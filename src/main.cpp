@@ -4,7 +4,9 @@
 
 #include <stb_image.h>
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 #include "shader.h"
 #include "engine.h"
@@ -90,11 +92,58 @@ public:
 	}
 };
 
+// fills random triangles of a few sizes, one call each and as one mesh, and prints triangles per second
+// both ways only fill (triangle() would stroke the edges too), so the columns differ only in the per-call cost
+class TriangleBenchmark : public pix2d::Engine {
+
+public:
+	bool create() override {
+		return true;
+	}
+
+	bool update(double delta_time) override {
+		const int sizes[] = { 4, 16, 64, 256 };
+		const int count = 20000;
+
+		for (int size : sizes) {
+			std::vector<glm::ivec2> vertices;
+			std::vector<uint32_t> indices;
+			for (int i = 0; i < count; i++) {
+				int x = rand() % (get_canvas_width() - size);
+				int y = rand() % (get_canvas_height() - size);
+				vertices.push_back(glm::ivec2(x + rand() % size, y));
+				vertices.push_back(glm::ivec2(x + size, y + rand() % size));
+				vertices.push_back(glm::ivec2(x, y + size));
+				for (int k = 0; k < 3; k++) indices.push_back(3 * i + k);
+			}
+
+			std::vector<glm::ivec2> single(3);
+			const std::vector<uint32_t> single_indices = { 0, 1, 2 };
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < count; i++) {
+				std::copy(vertices.begin() + 3 * i, vertices.begin() + 3 * i + 3, single.begin());
+				triangles(single, single_indices, pix2d::Pixel(255, 0, 0, 128));
+			}
+			double single_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			start = std::chrono::steady_clock::now();
+			triangles(vertices, indices, pix2d::Pixel(0, 0, 255, 128));
+			double mesh_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << size << "px: " << count / single_s / 1e6 << " M tri/s single, " << count / mesh_s / 1e6 << " M tri/s mesh" << std::endl;
+		}
+
+		return false;
+	}
+};
+
 int test();
+int benchmark_triangles();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 
 int main() {
 	// test();
+	// return benchmark_triangles();
 	MyTestEngine eng;
 	if (eng.initialise()) {
 		eng.start();
@@ -201,6 +250,13 @@ int test() {
 	return EXIT_SUCCESS;
 }
 
+int benchmark_triangles() {
+	TriangleBenchmark eng;
+	if (!eng.initialise(640, 480, 640, 480, "", pix2d::Backend::HEADLESS)) return EXIT_FAILURE;
+	eng.start();
+	return EXIT_SUCCESS;
+}
+
 void process_input(GLFWwindow* window) {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
 		glfwSetWindowShouldClose(window, true);
@@ -0,0 +1,133 @@
+#include "profiler.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace pix2d {
+    // stores a finished frame, overwriting the oldest
+    void Profiler::push(const FrameTimes& frame) {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        frames[n % PROFILER_FRAMES] = frame;
+        // publish the frame after it has been written
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    // copies up to max_frames of the most recent frames into out, oldest first, returns how many
+    int Profiler::get_frames(FrameTimes* out, int max_frames) const {
+        uint64_t n = count.load(std::memory_order_acquire);
+        int available = (int) std::min<uint64_t>(n, PROFILER_FRAMES);
+        int copied = std::min(available, max_frames);
+        for (int i = 0; i < copied; i++) {
+            out[i] = frames[(n - copied + i) % PROFILER_FRAMES];
+        }
+        return copied;
+    }
+
+    // stats of phase over the recorded frames
+    PhaseStats Profiler::get_stats(Phase phase) const {
+        FrameTimes recent[PROFILER_FRAMES];
+        int n = get_frames(recent, PROFILER_FRAMES);
+        return get_stats(recent, n, phase);
+    }
+
+    // stats of phase over n frames (at most PROFILER_FRAMES)
+    PhaseStats Profiler::get_stats(const FrameTimes* frames, int n, Phase phase) {
+        PhaseStats stats;
+        n = std::min(n, PROFILER_FRAMES);
+        if (n <= 0) return stats;
+
+        double values[PROFILER_FRAMES];
+        double total = 0.0;
+        for (int i = 0; i < n; i++) {
+            values[i] = frames[i].ms[(int) phase];
+            total += values[i];
+        }
+        stats.last = values[n - 1];
+        stats.mean = total / n;
+
+        // nearest-rank percentiles
+        std::sort(values, values + n);
+        auto percentile = [&](double p) { return values[std::max(0, (int) std::ceil(p * n) - 1)]; };
+        stats.p50 = percentile(0.50);
+        stats.p95 = percentile(0.95);
+        stats.p99 = percentile(0.99);
+        return stats;
+    }
+
+    uint64_t Profiler::get_count() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // fixed steps skipped over the recorded frames
+    int Profiler::get_skipped_steps() const {
+        FrameTimes recent[PROFILER_FRAMES];
+        int n = get_frames(recent, PROFILER_FRAMES);
+        return get_skipped_steps(recent, n);
+    }
+
+    // fixed steps skipped over n frames
+    int Profiler::get_skipped_steps(const FrameTimes* frames, int n) {
+        int skipped = 0;
+        for (int i = 0; i < n; i++) skipped += frames[i].skipped_steps;
+        return skipped;
+    }
+
+    const char* Profiler::get_name(Phase phase) {
+        switch (phase) {
+            case Phase::WAIT: return "wait";
+            case Phase::INPUT: return "input";
+            case Phase::FIXED: return "fixed";
+            case Phase::UPDATE: return "update";
+            case Phase::RASTER: return "raster";
+            case Phase::UPLOAD: return "upload";
+            case Phase::OVERLAY: return "overlay";
+            case Phase::SWAP: return "swap";
+            case Phase::POLL: return "poll";
+            case Phase::FRAME: return "frame";
+            default: return "";
+        }
+    }
+
+    // draws the frame-time graphs and percentiles as an imgui window
+    void Profiler::draw_overlay() const {
+        FrameTimes recent[PROFILER_FRAMES];
+        int n = get_frames(recent, PROFILER_FRAMES);
+        draw_overlay(recent, n);
+    }
+
+    // draws the graphs of n frames (at most PROFILER_FRAMES), oldest first
+    void Profiler::draw_overlay(const FrameTimes* frames, int n) {
+        n = std::min(n, PROFILER_FRAMES);
+
+        ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowBgAlpha(0.75f);
+        if (!ImGui::Begin("profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing)) {
+            ImGui::End();
+            return;
+        }
+
+        // frames that ran out of fixed step budget
+        int skipped = get_skipped_steps(frames, n);
+        if (skipped > 0) ImGui::Text("skipped fixed steps: %d", skipped);
+
+        // one graph per phase, the whole frame first
+        float values[PROFILER_FRAMES];
+        for (int p = PHASE_COUNT - 1; p >= 0; p--) {
+            Phase phase = (Phase) p;
+            PhaseStats stats = get_stats(frames, n, phase);
+            for (int i = 0; i < n; i++) values[i] = (float) frames[i].ms[p];
+
+            char label[96];
+            snprintf(label, sizeof(label), "%-7s p50 %6.2f  p95 %6.2f  p99 %6.2f ms", get_name(phase), stats.p50, stats.p95, stats.p99);
+            ImGui::TextUnformatted(label);
+            ImGui::PushID(p);
+            ImGui::PlotLines("", values, n, 0, nullptr, 0.0f, (float) std::max(stats.p99 * 1.25, 1.0), ImVec2(320, p == PHASE_COUNT - 1 ? 60.0f : 24.0f));
+            ImGui::PopID();
+        }
+
+        ImGui::End();
+    }
+}
@@ -0,0 +1,113 @@
+#include "rle_sprite.h"
+
+#include <cstring>
+
+#include "trace.h"
+
+namespace pix2d {
+    // create an empty sprite
+    RleSprite::RleSprite() {
+        row_runs.push_back(0);
+        row_pixels.push_back(0);
+    }
+
+    // encode a copy of sprite
+    RleSprite::RleSprite(Sprite* sprite) {
+        encode(sprite);
+    }
+
+    // create a sprite from image
+    RleSprite::RleSprite(const std::string& image) {
+        Sprite sprite(image);
+        encode(&sprite);
+    }
+
+    static RunKind kind_of(Pixel p) {
+        if (p.a == 0) return RunKind::TRANSPARENT;
+        if (p.a == 255) return RunKind::OPAQUE;
+        return RunKind::TRANSLUCENT;
+    }
+
+    void RleSprite::encode(Sprite* sprite) {
+        PIX2D_TRACE_ZONE("sprite encode");
+        row_runs.assign(1, 0);
+        row_pixels.assign(1, 0);
+        if (!sprite || !sprite->get_data()) return;
+
+        width = sprite->get_width();
+        height = sprite->get_height();
+
+        for (int j = 0; j < height; j++) {
+            Pixel* row = sprite->get_row(j);
+            int i = 0;
+            while (i < width) {
+                RunKind kind = kind_of(row[i]);
+                int end = i + 1;
+                while (end < width && end - i < UINT16_MAX && kind_of(row[end]) == kind) end++;
+
+                Run run;
+                run.length = (uint16_t) (end - i);
+                run.kind = kind;
+                runs.push_back(run);
+                if (kind != RunKind::TRANSPARENT) pixels.insert(pixels.end(), row + i, row + end);
+                i = end;
+            }
+            row_runs.push_back((uint32_t) runs.size());
+            row_pixels.push_back((uint32_t) pixels.size());
+        }
+
+        runs.shrink_to_fit();
+        pixels.shrink_to_fit();
+    }
+
+
+    // SPRITE DATA
+    // get width and height
+    int RleSprite::get_width() const {
+        return width;
+    }
+
+    int RleSprite::get_height() const {
+        return height;
+    }
+
+    // size of the encoded runs and pixels in bytes
+    size_t RleSprite::get_bytes() const {
+        return runs.size() * sizeof(Run) + pixels.size() * sizeof(Pixel) + (row_runs.size() + row_pixels.size()) * sizeof(uint32_t);
+    }
+
+    // blends columns i0 to i1 - 1 of row y (0 is the top) onto dst, where column i0 goes
+    void RleSprite::blit_row(int y, int i0, int i1, Pixel* dst, BlendMode mode) const {
+        // opaque pixels cover the destination in these modes, so they can be copied
+        bool copy_opaque = mode == BlendMode::ALPHA || mode == BlendMode::PREMULTIPLIED || mode == BlendMode::REPLACE;
+
+        const Run* run = runs.data() + row_runs[y];
+        const Run* end = runs.data() + row_runs[y + 1];
+        const Pixel* src = pixels.data() + row_pixels[y];
+
+        for (int x = 0; run != end && x < i1; run++) {
+            int a = x > i0 ? x : i0;
+            int b = x + run->length < i1 ? x + run->length : i1;
+
+            if (a < b) {
+                switch (run->kind) {
+                    case RunKind::TRANSPARENT:
+                        // only replacing changes the destination
+                        if (mode == BlendMode::REPLACE) blend_fill<BlendMode::REPLACE>(dst + (a - i0), Pixel(0, 0, 0, 0), b - a);
+                        break;
+                    case RunKind::OPAQUE:
+                        if (copy_opaque) memcpy(dst + (a - i0), src + (a - x), (b - a) * sizeof(Pixel));
+                        else blend_span(mode, dst + (a - i0), src + (a - x), b - a);
+                        break;
+                    case RunKind::TRANSLUCENT:
+                        blend_span(mode, dst + (a - i0), src + (a - x), b - a);
+                        break;
+                }
+            }
+
+            if (run->kind != RunKind::TRANSPARENT) src += run->length;
+            x += run->length;
+        }
+    }
+
+}
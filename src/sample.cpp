@@ -0,0 +1,156 @@
+#include "sample.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIX2D_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIX2D_SSE2
+#endif
+
+namespace pix2d {
+
+    // u + k * du, wrapping like the vector lanes do (only values inside the sprite are ever used)
+    static inline int32_t step(int32_t u, int32_t du, int k) {
+        return (int32_t) ((uint32_t) u + (uint32_t) du * (uint32_t) k);
+    }
+
+    // NEAREST
+    // texel (i, j) is top[i - j * w], rows are stored bottom-up
+    void sample_nearest(Sprite* sprite, int32_t u, int32_t v, int32_t du, int32_t dv, Pixel* out, int n) {
+        const Pixel* top = sprite->get_row(0);
+        int w = sprite->get_width();
+        int k = 0;
+
+#ifdef PIX2D_AVX2
+        // 8 addresses at a time, then one gather
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i w8 = _mm256_set1_epi32(w);
+        const __m256i du8 = _mm256_set1_epi32(step(0, du, 8)), dv8 = _mm256_set1_epi32(step(0, dv, 8));
+        __m256i uu = _mm256_add_epi32(_mm256_set1_epi32(u), _mm256_mullo_epi32(_mm256_set1_epi32(du), lanes));
+        __m256i vv = _mm256_add_epi32(_mm256_set1_epi32(v), _mm256_mullo_epi32(_mm256_set1_epi32(dv), lanes));
+        for (; k + 8 <= n; k += 8) {
+            __m256i idx = _mm256_sub_epi32(_mm256_srai_epi32(uu, 16), _mm256_mullo_epi32(_mm256_srai_epi32(vv, 16), w8));
+            _mm256_storeu_si256((__m256i*) (out + k), _mm256_i32gather_epi32((const int*) top, idx, 4));
+            uu = _mm256_add_epi32(uu, du8);
+            vv = _mm256_add_epi32(vv, dv8);
+        }
+#endif
+
+#ifdef PIX2D_SSE2
+        // 4 addresses at a time, j * w with a 16-bit multiply-add (both fit in 16 bits)
+        const __m128i w4 = _mm_set1_epi32(w);
+        const __m128i du4 = _mm_set1_epi32(step(0, du, 4)), dv4 = _mm_set1_epi32(step(0, dv, 4));
+        __m128i uu4 = _mm_setr_epi32(step(u, du, k), step(u, du, k + 1), step(u, du, k + 2), step(u, du, k + 3));
+        __m128i vv4 = _mm_setr_epi32(step(v, dv, k), step(v, dv, k + 1), step(v, dv, k + 2), step(v, dv, k + 3));
+        alignas(16) int32_t idx[4];
+        for (; k + 4 <= n; k += 4) {
+            __m128i jw = _mm_madd_epi16(_mm_srai_epi32(vv4, 16), w4);
+            _mm_store_si128((__m128i*) idx, _mm_sub_epi32(_mm_srai_epi32(uu4, 16), jw));
+            out[k] = top[idx[0]];
+            out[k + 1] = top[idx[1]];
+            out[k + 2] = top[idx[2]];
+            out[k + 3] = top[idx[3]];
+            uu4 = _mm_add_epi32(uu4, du4);
+            vv4 = _mm_add_epi32(vv4, dv4);
+        }
+#endif
+
+        for (; k < n; k++) {
+            int32_t uk = step(u, du, k), vk = step(v, dv, k);
+            out[k] = top[(uk >> 16) - (vk >> 16) * w];
+        }
+    }
+
+
+    // BILINEAR
+    static inline int clamp(int x, int hi) {
+        return x < 0 ? 0 : (x > hi ? hi : x);
+    }
+
+    // taps and weights of one bilinear sample, the weights are 8-bit fractions
+    struct Taps {
+        Pixel a, b, c, d; // top left, top right, bottom left, bottom right
+        uint32_t fx, fy;
+    };
+
+    static inline Taps taps(const Pixel* top, int w, int h, int32_t u, int32_t v) {
+        // texel centres are at +0.5
+        int32_t us = u - 0x8000, vs = v - 0x8000;
+        int i = us >> 16, j = vs >> 16;
+        int i0 = clamp(i, w - 1), i1 = clamp(i + 1, w - 1);
+        int j0 = clamp(j, h - 1), j1 = clamp(j + 1, h - 1);
+
+        Taps t;
+        t.a = top[i0 - j0 * w]; t.b = top[i1 - j0 * w];
+        t.c = top[i0 - j1 * w]; t.d = top[i1 - j1 * w];
+        t.fx = (uint32_t) (us >> 8) & 0xFF;
+        t.fy = (uint32_t) (vs >> 8) & 0xFF;
+        return t;
+    }
+
+    static inline uint8_t lerp2d(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t fx, uint32_t fy) {
+        uint32_t t = (a * (256 - fx) + b * fx) >> 8;
+        uint32_t s = (c * (256 - fx) + d * fx) >> 8;
+        return (uint8_t) ((t * (256 - fy) + s * fy) >> 8);
+    }
+
+    static inline Pixel lerp2d(const Taps& t) {
+        return Pixel(
+            lerp2d(t.a.r, t.b.r, t.c.r, t.d.r, t.fx, t.fy),
+            lerp2d(t.a.g, t.b.g, t.c.g, t.d.g, t.fx, t.fy),
+            lerp2d(t.a.b, t.b.b, t.c.b, t.d.b, t.fx, t.fy),
+            lerp2d(t.a.a, t.b.a, t.c.a, t.d.a, t.fx, t.fy));
+    }
+
+#ifdef PIX2D_SSE2
+    static inline uint32_t pack(Pixel p) {
+        uint32_t v;
+        memcpy(&v, &p, sizeof(v));
+        return v;
+    }
+
+    // same as lerp2d for 2 samples, all 4 channels of both in one register
+    // channels * weights are at most 255 * 256, so the 16-bit lanes never overflow
+    static inline void lerp2d_sse2(const Taps& t0, const Taps& t1, Pixel* out) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i c256 = _mm_set1_epi16(256);
+
+        __m128i a = _mm_unpacklo_epi8(_mm_setr_epi32((int) pack(t0.a), (int) pack(t1.a), 0, 0), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_setr_epi32((int) pack(t0.b), (int) pack(t1.b), 0, 0), zero);
+        __m128i c = _mm_unpacklo_epi8(_mm_setr_epi32((int) pack(t0.c), (int) pack(t1.c), 0, 0), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_setr_epi32((int) pack(t0.d), (int) pack(t1.d), 0, 0), zero);
+
+        __m128i fx = _mm_setr_epi16((short) t0.fx, (short) t0.fx, (short) t0.fx, (short) t0.fx, (short) t1.fx, (short) t1.fx, (short) t1.fx, (short) t1.fx);
+        __m128i fy = _mm_setr_epi16((short) t0.fy, (short) t0.fy, (short) t0.fy, (short) t0.fy, (short) t1.fy, (short) t1.fy, (short) t1.fy, (short) t1.fy);
+        __m128i ix = _mm_sub_epi16(c256, fx), iy = _mm_sub_epi16(c256, fy);
+
+        __m128i top = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, ix), _mm_mullo_epi16(b, fx)), 8);
+        __m128i bottom = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(c, ix), _mm_mullo_epi16(d, fx)), 8);
+        __m128i res = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, iy), _mm_mullo_epi16(bottom, fy)), 8);
+
+        _mm_storel_epi64((__m128i*) out, _mm_packus_epi16(res, zero));
+    }
+#endif
+
+    void sample_bilinear(Sprite* sprite, int32_t u, int32_t v, int32_t du, int32_t dv, Pixel* out, int n) {
+        const Pixel* top = sprite->get_row(0);
+        int w = sprite->get_width(), h = sprite->get_height();
+        int k = 0;
+
+#ifdef PIX2D_SSE2
+        for (; k + 2 <= n; k += 2) {
+            Taps t0 = taps(top, w, h, step(u, du, k), step(v, dv, k));
+            Taps t1 = taps(top, w, h, step(u, du, k + 1), step(v, dv, k + 1));
+            lerp2d_sse2(t0, t1, out + k);
+        }
+#endif
+
+        for (; k < n; k++) out[k] = lerp2d(taps(top, w, h, step(u, du, k), step(v, dv, k)));
+    }
+
+}
@@ -1,8 +1,10 @@
 #include "shader.h"
+#include "trace.h"
 
 Shader::Shader() {}
 
 Shader::Shader(const char* vertex_path, const char* fragment_path) {
+	PIX2D_TRACE_ZONE("shader compile");
 	std::string vertex_code;
 	std::string fragment_code;
 
@@ -71,50 +73,89 @@ Shader::Shader(const char* vertex_path, const char* fragment_path) {
 	// delete the shaders, since we don't need them anymore after we linked them
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
+
+	if (success) read_uniforms();
 }
 
 void Shader::use() {
 	glUseProgram(ID);
 }
 
+// reads every active uniform into the lookup table, so setting uniforms never queries the driver
+void Shader::read_uniforms() {
+	int count = 0, max_length = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	std::vector<char> buffer(max_length + 1);
+	for (int i = 0; i < count; i++) {
+		int length = 0, size = 0;
+		GLenum type;
+		glGetActiveUniform(ID, i, (GLsizei) buffer.size(), &length, &size, &type, buffer.data());
+		std::string name(buffer.data(), length);
+
+		// uniforms in blocks have no location
+		int loc = glGetUniformLocation(ID, name.c_str());
+		if (loc < 0) continue;
+
+		// arrays are reported as name[0], they can be looked up by that and by the base name
+		uniforms.emplace_back(name, loc);
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) uniforms.emplace_back(name.substr(0, name.size() - 3), loc);
+	}
+	std::sort(uniforms.begin(), uniforms.end());
+}
+
+// location of an active uniform, -1 if there is none
+int Shader::location(const std::string& name) const {
+	auto it = std::lower_bound(uniforms.begin(), uniforms.end(), name,
+		[](const std::pair<std::string, int>& u, const std::string& n) { return u.first < n; });
+	if (it != uniforms.end() && it->first == name) return it->second;
+
+	// other array elements (name[3], or members of struct arrays) aren't listed, ask the driver once and remember
+	if (name.find('[') == std::string::npos) return -1;
+	int loc = glGetUniformLocation(ID, name.c_str());
+	uniforms.insert(it, std::make_pair(name, loc));
+	return loc;
+}
+
 void Shader::set_bool(const std::string& name, bool value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1i(location(name), value);
 }
 
 void Shader::set_int(const std::string& name, int value) const {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1i(location(name), value);
 }
 
 void Shader::set_float(const std::string& name, float value) const {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1f(location(name), value);
 }
 
 void Shader::set_vector2(const std::string& name, const glm::vec2& value) const {
-	glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform2fv(location(name), 1, &value[0]);
 }
 
 void Shader::set_vector2(const std::string& name, float x, float y) const {
-	glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+	glUniform2f(location(name), x, y);
 }
 
 void Shader::set_vector3(const std::string& name, const glm::vec3& value) const {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform3fv(location(name), 1, &value[0]);
 }
 
 void Shader::set_vector3(const std::string& name, float x, float y, float z) const {
-	glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+	glUniform3f(location(name), x, y, z);
 }
 
 void Shader::set_vector4(const std::string& name, const glm::vec4& value) const {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform4fv(location(name), 1, &value[0]);
 }
 
 void Shader::set_vector4(const std::string& name, float x, float y, float z, float w) const {
-	glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+	glUniform4f(location(name), x, y, z, w);
 }
 
 
 void Shader::set_matrix4(const std::string& name, const glm::mat4& mat) const {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
 }
 
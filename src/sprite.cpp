@@ -1,6 +1,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 
 #include "sprite.h"
+#include "trace.h"
 
 namespace pix2d {
     // pixel constructors
@@ -16,6 +17,7 @@ namespace pix2d {
 
     // create a sprite from image
     Sprite::Sprite(const std::string& image) {
+        PIX2D_TRACE_ZONE("sprite load");
         // make sure to flip the image vertically
         stbi_set_flip_vertically_on_load(true);
         int channels;
@@ -81,6 +83,11 @@ namespace pix2d {
         }
     }
 
+    // get a pointer to the start of row y (no bounds checking, (0, 0) is the top left)
+    Pixel* Sprite::get_row(int y) {
+        return sprite_data + (height - y - 1) * width;
+    }
+
     // get a copy of this sprite
     Sprite* Sprite::duplicate() {
         return nullptr;
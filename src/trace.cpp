@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#ifdef PIX2D_ENABLE_TRACE
+
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pix2d {
+    namespace trace {
+
+        // a finished zone
+        struct Event {
+            const char* name;
+            uint64_t start, end;
+        };
+
+        // single producer (the owning thread), single consumer (the flusher) ring of events
+        struct ThreadBuffer {
+            Event events[THREAD_BUFFER_EVENTS];
+            std::atomic<uint32_t> head { 0 }; // next slot to write, only the owner stores it
+            std::atomic<uint32_t> tail { 0 }; // next slot to read, only the flusher stores it
+            std::atomic<uint64_t> dropped { 0 };
+            uint32_t tid = 0;
+        };
+
+        std::atomic<bool> session_active { false };
+
+        // buffers are never freed, a thread may still hold a pointer to its buffer after its last session
+        static std::mutex registry_mutex;
+        static std::vector<std::unique_ptr<ThreadBuffer>> registry;
+        static thread_local ThreadBuffer* local_buffer = nullptr;
+
+        // session state, only touched by begin_session, end_session and the flusher
+        static std::mutex session_mutex;
+        static std::condition_variable flusher_cv;
+        static std::thread flusher;
+        static bool stopping = false;
+        static FILE* file = nullptr;
+        static bool first_event = true;
+        static uint64_t origin = 0;
+
+        static ThreadBuffer* get_local_buffer() {
+            if (!local_buffer) {
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                registry.emplace_back(new ThreadBuffer());
+                local_buffer = registry.back().get();
+                local_buffer->tid = (uint32_t) registry.size();
+            }
+            return local_buffer;
+        }
+
+        // stores a finished zone in the calling thread's buffer, never blocks
+        void record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+            if (!active()) return;
+            ThreadBuffer* buffer = get_local_buffer();
+
+            uint32_t head = buffer->head.load(std::memory_order_relaxed);
+            if (head - buffer->tail.load(std::memory_order_acquire) >= THREAD_BUFFER_EVENTS) {
+                buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            buffer->events[head % THREAD_BUFFER_EVENTS] = { name, start_ns, end_ns };
+            buffer->head.store(head + 1, std::memory_order_release);
+        }
+
+        // writes every waiting event as a complete ("X") event, times in microseconds
+        static void drain() {
+            std::vector<ThreadBuffer*> buffers;
+            {
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                for (auto& b : registry) buffers.push_back(b.get());
+            }
+
+            for (ThreadBuffer* buffer : buffers) {
+                uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+                uint32_t head = buffer->head.load(std::memory_order_acquire);
+                for (; tail != head; tail++) {
+                    const Event& e = buffer->events[tail % THREAD_BUFFER_EVENTS];
+                    // zones started before the session have no place on its timeline
+                    if (e.start >= origin) {
+                        fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                            first_event ? "" : ",", e.name, buffer->tid, (e.start - origin) / 1000.0, (e.end - e.start) / 1000.0);
+                        first_event = false;
+                    }
+                }
+                buffer->tail.store(tail, std::memory_order_release);
+            }
+        }
+
+        // wakes up every few ms to empty the thread buffers into the file
+        static void flusher_loop() {
+            std::unique_lock<std::mutex> lock(session_mutex);
+            while (!stopping) {
+                flusher_cv.wait_for(lock, std::chrono::milliseconds(5));
+                drain();
+            }
+        }
+
+        // opens path and starts the background flusher
+        bool begin_session(const std::string& path) {
+            std::lock_guard<std::mutex> lock(session_mutex);
+            if (file) return false;
+
+            file = fopen(path.c_str(), "w");
+            if (!file) {
+                std::cout << "ERROR::TRACE::FILE_NOT_OPENED " << path << std::endl;
+                return false;
+            }
+            fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+            first_event = true;
+            origin = now_ns();
+
+            // forget anything left over from a previous session
+            {
+                std::lock_guard<std::mutex> registry_lock(registry_mutex);
+                for (auto& b : registry) {
+                    b->tail.store(b->head.load(std::memory_order_acquire), std::memory_order_release);
+                    b->dropped.store(0, std::memory_order_relaxed);
+                }
+            }
+
+            stopping = false;
+            session_active = true;
+            flusher = std::thread(flusher_loop);
+            return true;
+        }
+
+        // stops the flusher, writes the remaining zones and closes the file
+        void end_session() {
+            {
+                std::lock_guard<std::mutex> lock(session_mutex);
+                if (!file) return;
+                session_active = false;
+                stopping = true;
+            }
+            flusher_cv.notify_all();
+            flusher.join();
+
+            std::lock_guard<std::mutex> lock(session_mutex);
+            drain();
+            fprintf(file, "\n]}\n");
+            fclose(file);
+            file = nullptr;
+
+            if (dropped() > 0) std::cout << "TRACE::DROPPED_ZONES " << dropped() << std::endl;
+        }
+
+        // zones dropped because a thread buffer was full
+        uint64_t dropped() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            uint64_t total = 0;
+            for (auto& b : registry) total += b->dropped.load(std::memory_order_relaxed);
+            return total;
+        }
+
+    }
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include "workers.h"
+
+namespace pix2d {
+    // threads <= 0 uses one thread per hardware thread (the calling thread counts as one)
+    WorkerPool::WorkerPool(int threads) {
+        if (threads <= 0) threads = (int) std::thread::hardware_concurrency();
+        if (threads <= 0) threads = 1;
+
+        // the thread calling run() does its share of the work
+        for (int i = 1; i < threads; i++) {
+            this->threads.emplace_back(&WorkerPool::worker, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    // runs job(i) for every 0 <= i < count on the pool and the calling thread, returns when all are done
+    void WorkerPool::run(int count, const std::function<void(int)>& job) {
+        if (count <= 0) return;
+
+        // not worth waking anyone up
+        if (threads.empty() || count == 1) {
+            for (int i = 0; i < count; i++) job(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->job = &job;
+            job_count = count;
+            next_index = 0;
+            active = (int) threads.size();
+            generation++;
+        }
+        start_cv.notify_all();
+
+        drain();
+
+        // wait for the workers to finish their last index
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this] { return active == 0; });
+        this->job = nullptr;
+    }
+
+    // number of threads working on a job, including the calling thread
+    int WorkerPool::get_size() {
+        return (int) threads.size() + 1;
+    }
+
+    // worker thread loop
+    void WorkerPool::worker() {
+        unsigned long long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start_cv.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            drain();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0) done_cv.notify_one();
+            }
+        }
+    }
+
+    // takes job indices until there are none left
+    void WorkerPool::drain() {
+        int i;
+        while ((i = next_index.fetch_add(1)) < job_count) (*job)(i);
+    }
+}